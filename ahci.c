@@ -0,0 +1,482 @@
+// AHCI (SATA) disk driver.
+//
+// Drives an AHCI controller such as QEMU's ICH9 (-device ahci)
+// through its memory-mapped registers, which must lie in the
+// device space that setupkvm maps at 0xFE000000.  The first
+// NAHCI ports with a disk attached are disks AHCIDEV, AHCIDEV+1.
+//
+// Each port has 32 command slots: a command header in the port's
+// command list points to a command table holding the ATA command
+// (a FIS) and the physical regions of its data.  If the disk
+// supports native command queueing, reads and writes are issued
+// as READ/WRITE FPDMA QUEUED, tagged with their slot, and the disk
+// completes them in whatever order suits it; otherwise one READ/
+// WRITE DMA EXT runs at a time.  The port interrupt handler finds
+// the slots the disk is done with and wakes their bufs.
+//
+// As with virtio, up to DISK_DEPTH commands are in flight and more
+// bufs wait in the port's I/O scheduler queue; a command moves the
+// next buf and the ones after it holding the following blocks,
+// up to DISK_MERGE sectors.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "disk.h"
+#include "iosched.h"
+
+#define NAHCI         2     // AHCI disks
+#define AHCIDEV       6     // dev of the first one
+#define NSLOT         32
+
+// HBA registers
+#define HBA_CAP       0x00
+#define HBA_GHC       0x04
+#define HBA_IS        0x08  // ports with an interrupt pending
+#define HBA_PI        0x0c  // ports implemented
+
+#define CAP_NCQ       (1<<30)
+#define CAP_NCS(c)    ((((c)>>8) & 0x1f) + 1)  // command slots
+#define GHC_IE        (1<<1)
+#define GHC_AE        (1<<31)
+
+// Port registers, at 0x100 + 0x80 * port
+#define PX_CLB        0x00  // command list
+#define PX_FB         0x08  // received FIS area
+#define PX_IS         0x10
+#define PX_IE         0x14
+#define PX_CMD        0x18
+#define PX_TFD        0x20  // task file: ATA status and error
+#define PX_SIG        0x24
+#define PX_SSTS       0x28
+#define PX_SERR       0x30
+#define PX_SACT       0x34  // queued commands outstanding
+#define PX_CI         0x38  // commands issued
+
+#define PXCMD_ST      (1<<0)
+#define PXCMD_FRE     (1<<4)
+#define PXCMD_FR      (1<<14)
+#define PXCMD_CR      (1<<15)
+#define PXIS_DHRS     (1<<0)   // register FIS: a command finished
+#define PXIS_SDBS     (1<<3)   // set device bits FIS: queued ones did
+#define PXIS_TFES     (1<<30)  // task file error
+#define SIG_ATA       0x00000101
+#define TFD_BUSY      0x88     // BSY, DRQ
+#define TFD_ERR       0x01
+
+#define FIS_H2D       0x27  // register FIS, host to device
+
+#define ATA_IDENTIFY  0xec
+#define ATA_RDDMAEXT  0x25
+#define ATA_WRDMAEXT  0x35
+#define ATA_RDFPDMA   0x60  // READ FPDMA QUEUED
+#define ATA_WRFPDMA   0x61
+
+struct cmdhdr {
+  ushort flags;       // FIS length in dwords, CH_*
+  ushort prdtl;       // physical region descriptors
+  uint prdbc;         // bytes moved
+  uint ctba;          // command table
+  uint ctbau;
+  uint rsv[4];
+};
+#define CH_WRITE      (1<<6)
+
+struct aprd {
+  uint dba;
+  uint dbau;
+  uint rsv;
+  uint dbc;           // bytes - 1
+};
+
+struct cmdtbl {
+  uchar cfis[64];
+  uchar acmd[16];
+  uchar rsv[48];
+  struct aprd prdt[NBUF];
+} __attribute__((aligned(128)));
+
+struct aport {
+  struct spinlock lock;
+  int port;
+  uint regs;            // port registers
+  int ncq;              // disk does native command queueing
+  int nslot;            // slots usable
+  uint busy;            // slots in flight
+  int nbusy;
+  int depth;            // most slots in flight
+  int maxmerge;         // most sectors per command
+  struct buf *slot[NSLOT];  // bufs of each slot, linked by qnext
+  struct ioq ioq;
+
+  struct cmdhdr clist[NSLOT] __attribute__((aligned(1024)));
+  uchar fis[256] __attribute__((aligned(256)));
+  struct cmdtbl tbl[NSLOT];
+};
+
+static uint abar;       // HBA registers
+static int airq;
+static struct aport aports[NAHCI];
+static int naport;
+
+#define AREG(a)     (*(volatile uint*)(a))
+#define PREG(p, r)  AREG((p)->regs + (r))
+
+// Stop port p's command engine.
+static void
+astop(struct aport *p)
+{
+  PREG(p, PX_CMD) &= ~(PXCMD_ST|PXCMD_FRE);
+  while(PREG(p, PX_CMD) & (PXCMD_CR|PXCMD_FR))
+    ;
+}
+
+// Start port p's command engine.
+static void
+astart(struct aport *p)
+{
+  PREG(p, PX_CMD) |= PXCMD_FRE;
+  while(PREG(p, PX_TFD) & TFD_BUSY)
+    ;
+  PREG(p, PX_CMD) |= PXCMD_ST;
+}
+
+// Fill in the FIS of slot s for command cmd on n sectors from sector.
+static void
+afis(struct aport *p, int s, int cmd, uint sector, int n)
+{
+  uchar *f;
+
+  f = p->tbl[s].cfis;
+  memset(f, 0, 20);
+  f[0] = FIS_H2D;
+  f[1] = 0x80;  // command, not control
+  f[2] = cmd;
+  f[4] = sector;
+  f[5] = sector >> 8;
+  f[6] = sector >> 16;
+  f[7] = 0x40;  // LBA
+  f[8] = sector >> 24;
+  if(cmd == ATA_RDFPDMA || cmd == ATA_WRFPDMA){
+    f[3] = n;        // count goes in features,
+    f[11] = n >> 8;
+    f[12] = s << 3;  // and the tag in count
+  } else {
+    f[12] = n;
+    f[13] = n >> 8;
+  }
+}
+
+// Point slot s at its command table, with n regions, and issue it.
+static void
+aissue(struct aport *p, int s, int n, int write)
+{
+  struct cmdhdr *h;
+
+  h = &p->clist[s];
+  h->flags = 5 | (write ? CH_WRITE : 0);  // 5-dword FIS
+  h->prdtl = n;
+  h->prdbc = 0;
+  h->ctba = PADDR(&p->tbl[s]);
+  h->ctbau = 0;
+  __sync_synchronize();
+  if(p->ncq)
+    PREG(p, PX_SACT) = 1 << s;
+  PREG(p, PX_CI) = 1 << s;
+}
+
+// Ask the disk on p whether it can queue commands, polling
+// for the answer.  Interrupts are not enabled yet.
+static void
+aidentify(struct aport *p)
+{
+  static ushort id[256];
+  struct aprd *d;
+
+  afis(p, 0, ATA_IDENTIFY, 0, 0);
+  p->tbl[0].cfis[7] = 0;
+  d = &p->tbl[0].prdt[0];
+  d->dba = PADDR(id);
+  d->dbau = 0;
+  d->dbc = sizeof(id) - 1;
+  p->ncq = 0;
+  aissue(p, 0, 1, 0);
+  while(PREG(p, PX_CI) & 1)
+    if(PREG(p, PX_TFD) & TFD_ERR)
+      return;
+  if(id[76] & (1<<8)){  // SATA capabilities: NCQ
+    p->ncq = 1;
+    if(p->nslot > (id[75] & 0x1f) + 1)
+      p->nslot = (id[75] & 0x1f) + 1;
+  }
+}
+
+// Set up port i of the HBA if a disk is attached.
+static int
+aportinit(struct aport *p, int i, uint cap)
+{
+  p->port = i;
+  p->regs = abar + 0x100 + 0x80*i;
+  if((PREG(p, PX_SSTS) & 0xf) != 3 || PREG(p, PX_SIG) != SIG_ATA)
+    return -1;  // no device, or not a disk
+  astop(p);
+  memset(p->clist, 0, sizeof(p->clist));
+  memset(p->fis, 0, sizeof(p->fis));
+  PREG(p, PX_CLB) = PADDR(p->clist);
+  PREG(p, PX_CLB+4) = 0;
+  PREG(p, PX_FB) = PADDR(p->fis);
+  PREG(p, PX_FB+4) = 0;
+  PREG(p, PX_SERR) = 0xffffffff;
+  PREG(p, PX_IS) = 0xffffffff;
+  astart(p);
+
+  p->nslot = CAP_NCS(cap);
+  aidentify(p);
+  if(!(cap & CAP_NCQ))
+    p->ncq = 0;
+  initlock(&p->lock, "ahci");
+  ioqinit(&p->ioq, SCHED_DEADLINE);
+  p->depth = p->ncq ? p->nslot : 1;
+  p->maxmerge = NBUF * MAXBSIZE/SECTSIZE;
+  PREG(p, PX_IS) = 0xffffffff;
+  PREG(p, PX_IE) = PXIS_DHRS|PXIS_SDBS|PXIS_TFES;
+  return 0;
+}
+
+void
+ahciinit(void)
+{
+  struct pcidev d;
+  uint cap, pi;
+  int i;
+
+  if(pcifind(PCI_ANY, PCI_ANY, 0x01, 0x06, 0, &d) < 0 || d.progif != 0x01)
+    return;
+  abar = d.bar[5] & ~0xf;
+  if(abar < 0xFE000000){
+    cprintf("ahci: registers at %x are not mapped\n", abar);
+    return;
+  }
+  pciwrite(&d, PCI_COMMAND, pciread(&d, PCI_COMMAND) | PCI_CMD_MEM | PCI_CMD_MASTER);
+  airq = d.irq;
+  AREG(abar+HBA_GHC) |= GHC_AE;
+  cap = AREG(abar+HBA_CAP);
+  pi = AREG(abar+HBA_PI);
+  for(i = 0; i < 32 && naport < NAHCI; i++){
+    if(!(pi & (1<<i)) || aportinit(&aports[naport], i, cap) < 0)
+      continue;
+    bdevsw[AHCIDEV+naport].rw = ahcirw;
+    bdevsw[AHCIDEV+naport].prefetch = ahciprefetch;
+    bdevsw[AHCIDEV+naport].ctl = ahcictl;
+    cprintf("ahci: disk %d on port %d%s\n", AHCIDEV+naport, i,
+            aports[naport].ncq ? ", queued" : "");
+    naport++;
+  }
+  if(naport == 0)
+    return;
+  AREG(abar+HBA_IS) = 0xffffffff;
+  AREG(abar+HBA_GHC) |= GHC_IE;
+  picenable(airq);
+  ioapicenable(airq, ncpu - 1);
+}
+
+// Start commands for the bufs waiting on p while fewer than
+// p->depth are in flight.  Caller must hold p->lock.
+static void
+adispatch(struct aport *p)
+{
+  struct buf *b;
+  struct aprd *d;
+  int s, n, nsect, w;
+
+  while(p->nbusy < p->depth && ioqnext(&p->ioq) != 0){
+    for(s = 0; p->busy & (1<<s); s++)
+      ;
+    b = ioqtake(&p->ioq, p->maxmerge, &n);
+    p->slot[s] = b;
+    p->busy |= 1 << s;
+    p->nbusy++;
+
+    nsect = b->bsize / SECTSIZE;
+    w = (b->flags & B_DIRTY) != 0;
+    if(p->ncq)
+      afis(p, s, w ? ATA_WRFPDMA : ATA_RDFPDMA, b->sector*nsect, n*nsect);
+    else
+      afis(p, s, w ? ATA_WRDMAEXT : ATA_RDDMAEXT, b->sector*nsect, n*nsect);
+    for(d = p->tbl[s].prdt; b; b = b->qnext, d++){
+      d->dba = PADDR(b->data);
+      d->dbau = 0;
+      d->rsv = 0;
+      d->dbc = b->bsize - 1;
+    }
+    aissue(p, s, n, w);
+  }
+}
+
+// Finish the commands the disk on p is done with.
+// A port stops at an error, and a queueing disk drops all
+// its commands: then fail every command in flight, with
+// B_ERROR, and restart the port.
+static void
+aintr(struct aport *p)
+{
+  struct buf *b, *async;
+  uint is, done, failed;
+  int s;
+
+  acquire(&p->lock);
+  is = PREG(p, PX_IS);
+  PREG(p, PX_IS) = is;
+  failed = 0;
+  if(is & PXIS_TFES){
+    cprintf("ahci: disk %d: error, status %x\n",
+            AHCIDEV + (p - aports), PREG(p, PX_TFD));
+    astop(p);
+    PREG(p, PX_SERR) = 0xffffffff;
+    PREG(p, PX_IS) = 0xffffffff;
+    astart(p);
+    failed = done = p->busy;
+  } else
+    done = p->busy & ~(PREG(p, PX_CI) | PREG(p, PX_SACT));
+  async = 0;
+  for(s = 0; s < NSLOT; s++){
+    if(!(done & (1<<s)))
+      continue;
+    while((b = p->slot[s]) != 0){
+      p->slot[s] = b->qnext;
+      diskdone(b);
+      if(failed & (1<<s))
+        b->flags |= B_ERROR;
+      b->flags |= B_VALID;
+      b->flags &= ~B_DIRTY;
+      wakeup(b);
+      if(b->flags & B_ASYNC){
+        b->qnext = async;
+        async = b;
+      }
+    }
+    p->busy &= ~(1<<s);
+    p->nbusy--;
+  }
+  adispatch(p);
+  release(&p->lock);
+
+  // No process waits for a prefetched buf.
+  while((b = async) != 0){
+    async = b->qnext;
+    brelse(b);
+  }
+}
+
+// Interrupt handler.  Returns 0 if irq is not the HBA's.
+// The I/O APIC takes the line as edge-triggered, so a port that
+// wants service again while we are here sends no new edge: go
+// on until no port wants it.
+int
+ahciintr(int irq)
+{
+  uint is, mask;
+  int i;
+
+  if(naport == 0 || irq != airq)
+    return 0;
+  mask = 0;
+  for(i = 0; i < naport; i++)
+    mask |= 1 << aports[i].port;
+  while((is = AREG(abar+HBA_IS) & mask) != 0){
+    for(i = 0; i < naport; i++)
+      if(is & (1 << aports[i].port))
+        aintr(&aports[i]);
+    AREG(abar+HBA_IS) = is;
+  }
+  return 1;
+}
+
+static struct aport*
+aport(uint dev)
+{
+  if(dev < AHCIDEV || dev >= AHCIDEV+naport)
+    panic("ahci: no disk");
+  return &aports[dev-AHCIDEV];
+}
+
+// Start reading b for bprefetch and return at once.
+// aintr releases b when the read completes.
+void
+ahciprefetch(struct buf *b)
+{
+  struct aport *p;
+
+  if((b->flags & (B_BUSY|B_ASYNC|B_VALID|B_DIRTY)) != (B_BUSY|B_ASYNC))
+    panic("ahciprefetch");
+  p = aport(b->dev);
+  acquire(&p->lock);
+  ioqadd(&p->ioq, b);
+  adispatch(p);
+  release(&p->lock);
+}
+
+// Sync buf with disk, like iderw.
+void
+ahcirw(struct buf *b)
+{
+  struct aport *p;
+
+  if(!(b->flags & B_BUSY))
+    panic("ahcirw: buf not busy");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("ahcirw: nothing to do");
+  p = aport(b->dev);
+  acquire(&p->lock);
+  ioqadd(&p->ioq, b);
+  adispatch(p);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &p->lock);
+  release(&p->lock);
+}
+
+// Read, and unless val < 0 change, setting op (DISK_*) of disk dev.
+// Returns the old value, or -1.
+int
+ahcictl(int dev, int op, int val)
+{
+  struct aport *p;
+  int old;
+
+  if(dev < AHCIDEV || dev >= AHCIDEV+naport)
+    return -1;
+  p = &aports[dev-AHCIDEV];
+  acquire(&p->lock);
+  switch(op){
+  case DISK_DEPTH:
+    old = p->depth;
+    if(val == 0 || val > (p->ncq ? p->nslot : 1))
+      old = -1;
+    else if(val > 0){
+      p->depth = val;
+      adispatch(p);
+    }
+    break;
+  case DISK_SCHED:
+    old = p->ioq.policy;
+    if(val >= 0 && ioqpolicy(&p->ioq, val) < 0)
+      old = -1;
+    break;
+  case DISK_MERGE:
+    old = p->maxmerge;
+    if(val >= 0)
+      p->maxmerge = val;
+    break;
+  default:
+    old = -1;
+  }
+  release(&p->lock);
+  return old;
+}
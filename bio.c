@@ -7,11 +7,20 @@
 // 
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+// * To get a zeroed buffer for a newly allocated block, call bnew.
+// * To start reading a block that will be wanted soon without
+//     waiting for it, call bprefetch.
+// * To have a cached block that will not be wanted again reused
+//     before others, call bforget.
+// * Blocks are SECTSIZE bytes until bsetsize gives the device
+//     the block size of its file system.
 // * After changing buffer data, call bwrite to flush it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * Blocks go to and from the disk through the driver that
+//     registered the device in bdevsw.
 // 
 // The implementation uses three state flags internally:
 // * B_BUSY: the block has been returned from bread
@@ -20,11 +29,14 @@
 //     with the associated disk block contents.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ASYNC: the buffer is being read for bprefetch;
+//     the disk driver releases it when the read is done.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
 
 struct {
@@ -34,10 +46,15 @@ struct {
 	// Linked list of all buffers, through prev/next.
 	// head.next is most recently used.
 	struct buf head;
+
+	uint bsize[NDISK];  // block size of each disk
+	int nprefetch;      // B_ASYNC buffers
 } bcache;
 
 struct buf* anchor_table[HASHSIZE]; /* the table elements */
 
+struct bdevsw bdevsw[NDISK];
+
 uint hash(uint dev, uint sector)
 {
 	uint key = dev + sector;
@@ -148,13 +165,41 @@ binit(void)
 	for(i=0;i<HASHSIZE;i++) {
 		anchor_table[i] = 0;
 	}
+	for(i = 0; i < NDISK; i++)
+		bcache.bsize[i] = SECTSIZE;
+}
+
+// Set the block size of dev, a multiple of SECTSIZE no larger
+// than MAXBSIZE.  Cached blocks of dev were read with the old
+// size, so they are invalidated.
+void
+bsetsize(uint dev, uint size)
+{
+	struct buf *b;
+
+	if(dev >= NDISK || size % SECTSIZE || size > MAXBSIZE)
+		panic("bsetsize");
+	acquire(&bcache.lock);
+	if(bcache.bsize[dev] != size){
+		bcache.bsize[dev] = size;
+		for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+			if(b->dev == dev){
+				if(b->flags & B_BUSY)
+					panic("bsetsize: busy");
+				b->flags &= ~B_VALID;
+			}
+		}
+	}
+	release(&bcache.lock);
 }
 
 // Look through buffer cache for sector on device dev.
 // If not found, allocate fresh block.
 // In either case, return locked buffer.
+// For a prefetch, return 0 instead if the block is cached
+// or no buffer is free.
 static struct buf*
-bget(uint dev, uint sector, uint inodenum)
+bget(uint dev, uint sector, uint inodenum, int prefetch)
 {
 
 	struct buf *b;
@@ -166,6 +211,10 @@ bget(uint dev, uint sector, uint inodenum)
 		// Try for cached block.
 		for(b = anchor_table[hashval]; b != 0; b = b->bnext){
 			if(b->dev == dev && b->sector == sector){
+				if(prefetch){
+					release(&bcache.lock);
+					return 0;
+				}
 				if(!(b->flags & B_BUSY)){
 					b->flags |= B_BUSY;
 					release(&bcache.lock);
@@ -176,50 +225,53 @@ bget(uint dev, uint sector, uint inodenum)
 			}
 		}
 	}
-	// Allocate fresh block.
+	// Allocate fresh block.  An inode holding SRP blocks replaces
+	// one of its own.  If all of those are busy, say being
+	// prefetched, it falls back to the least recently used buffer.
 	if ((SRP >= 3) && (inodenum != 0)) {
 		counter = countblocks(dev, inodenum);
 	}
-	if((counter < SRP) || (SRP < 3) || (inodenum == 0)) {
-		for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-			if((b->flags & B_BUSY) == 0){
-				if(b->dev != -1)
-					beforeupdate(b);
-				b->dev = dev;
-				b->sector = sector;
-				b->flags = B_BUSY;
-				b->inum = inodenum;
-				afterupdate(b);
-#ifdef TRUE
-				printcache();
-#endif
-				release(&bcache.lock);
-				return b;
-			}
-		}
-	}
-	else {
+	if((counter >= SRP) && (SRP >= 3) && (inodenum != 0)) {
 		//Replace the block of the current inode
 		for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-			if((b->dev == dev) && (b->inum == inodenum)) {
-				if((b->flags & B_BUSY) == 0){
-					beforeupdate(b);
-					b->dev = dev;
-					b->sector = sector;
-					b->flags = B_BUSY;
-					b->inum = inodenum;
-					afterupdate(b);
-#ifdef TRUE
-					printcache();
-#endif
-					release(&bcache.lock);
-					return b;
-				}
-			}
+			if((b->dev == dev) && (b->inum == inodenum) &&
+			   (b->flags & B_BUSY) == 0)
+				goto found;
 		}
 	}
+	for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+		if((b->flags & B_BUSY) == 0)
+			goto found;
+	}
+	if(prefetch){
+		release(&bcache.lock);
+		return 0;
+	}
 	panic("bget: no buffers");
 
+found:
+	if(b->dev != -1)
+		beforeupdate(b);
+	b->dev = dev;
+	b->sector = sector;
+	b->flags = B_BUSY;
+	b->inum = inodenum;
+	afterupdate(b);
+#ifdef TRUE
+	printcache();
+#endif
+	release(&bcache.lock);
+	return b;
+
+}
+
+// Read or write b with the driver of its disk.
+static void
+bdevrw(struct buf *b)
+{
+	if(b->dev >= NDISK || bdevsw[b->dev].rw == 0)
+		panic("bdevrw: no disk");
+	bdevsw[b->dev].rw(b);
 }
 
 // Return a B_BUSY buf with the contents of the indicated disk sector.
@@ -228,12 +280,84 @@ bread(uint dev, uint sector, uint inodenum)
 {
 	struct buf *b;
 
-	b = bget(dev, sector, inodenum);
-	if(!(b->flags & B_VALID))
-		iderw(b);
+	b = bget(dev, sector, inodenum, 0);
+	if(!(b->flags & B_VALID)){
+		b->bsize = bcache.bsize[dev];
+		bdevrw(b);
+	}
+	return b;
+}
+
+// Return a B_BUSY buf for a newly allocated sector, zero-filled
+// in memory instead of being read from disk.  Freed blocks are
+// not zeroed on disk, so the caller must bwrite the buffer
+// before releasing it.
+struct buf*
+bnew(uint dev, uint sector, uint inodenum)
+{
+	struct buf *b;
+
+	b = bget(dev, sector, inodenum, 0);
+	b->bsize = bcache.bsize[dev];
+	memset(b->data, 0, b->bsize);
+	b->flags |= B_VALID;
 	return b;
 }
 
+// Start reading sector into the cache without waiting for it.
+// At most NBUF/2 buffers are prefetching at once, so that
+// bget always finds a free buffer for ordinary reads.
+void
+bprefetch(uint dev, uint sector, uint inodenum)
+{
+	struct buf *b;
+
+	if(dev >= NDISK || bdevsw[dev].prefetch == 0)
+		return;
+	acquire(&bcache.lock);
+	if(bcache.nprefetch >= NBUF/2){
+		release(&bcache.lock);
+		return;
+	}
+	bcache.nprefetch++;
+	release(&bcache.lock);
+
+	if((b = bget(dev, sector, inodenum, 1)) == 0){
+		acquire(&bcache.lock);
+		bcache.nprefetch--;
+		release(&bcache.lock);
+		return;
+	}
+	b->bsize = bcache.bsize[dev];
+	b->flags |= B_ASYNC;
+	bdevsw[dev].prefetch(b);
+}
+
+// If sector is cached and not in use, move its buffer to the
+// least recently used end of the list, so that it is the next
+// one reused.
+void
+bforget(uint dev, uint sector)
+{
+	struct buf *b;
+
+	acquire(&bcache.lock);
+	for(b = anchor_table[hash(dev, sector)]; b != 0; b = b->bnext){
+		if(b->dev == dev && b->sector == sector){
+			if(!(b->flags & B_BUSY)){
+				b->next->prev = b->prev;
+				b->prev->next = b->next;
+				b->prev = bcache.head.prev;
+				b->next = &bcache.head;
+				bcache.head.prev->next = b;
+				bcache.head.prev = b;
+			}
+			break;
+		}
+	}
+	release(&bcache.lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -241,7 +365,7 @@ bwrite(struct buf *b)
 	if((b->flags & B_BUSY) == 0)
 		panic("bwrite");
 	b->flags |= B_DIRTY;
-	iderw(b);
+	bdevrw(b);
 }
 
 // Release the buffer b.
@@ -253,6 +377,10 @@ brelse(struct buf *b)
 
 	acquire(&bcache.lock);
 
+	if(b->flags & B_ASYNC){
+		b->flags &= ~B_ASYNC;
+		bcache.nprefetch--;
+	}
 	b->next->prev = b->prev;
 	b->prev->next = b->next;
 	b->next = bcache.head.next;
@@ -260,6 +388,9 @@ brelse(struct buf *b)
 	bcache.head.next->prev = b;
 	bcache.head.next = b;
 
+	// Do not keep what a failed read left behind.
+	if(b->flags & B_ERROR)
+		b->flags &= ~(B_VALID|B_ERROR);
 	b->flags &= ~B_BUSY;
 	wakeup(b);
 
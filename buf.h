@@ -5,7 +5,14 @@ struct buf {
   struct buf *prev; // LRU cache list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[512];
+  struct buf *qprev;
+  int qheap;         // index in the I/O scheduler's heap
+  uint qsweep;       // C-LOOK sweep that serves the buf
+  uint qdeadline;    // tick by which the buf should be served
+  uint64 tqueue;     // rdtsc() when queued for the disk
+  uint64 tstart;     // rdtsc() when sent to the disk
+  uint bsize;        // block size of dev, in bytes
+  uchar data[MAXBSIZE];
   struct buf *bnext;
   struct buf *bprev;
   uint inum;          // Inode number that holds the buf
@@ -13,4 +20,16 @@ struct buf {
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // buffer is being read by bprefetch
+#define B_ERROR 0x10 // the disk failed to read or write buffer
 
+
+// Block device drivers, indexed by dev.  A driver fills in the
+// entries of the disks it finds when it is initialized.
+struct bdevsw {
+  void (*rw)(struct buf*);        // read or write, and wait
+  void (*prefetch)(struct buf*);  // start a read of a B_ASYNC buf
+  int (*ctl)(int, int, int);      // diskctl(dev, op, val)
+};
+
+extern struct bdevsw bdevsw[];
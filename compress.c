@@ -0,0 +1,30 @@
+// compress: store files compressed, reporting the number of
+// disk blocks each one saves.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, n;
+
+  if(argc < 2){
+    printf(2, "usage: compress file...\n");
+    exit();
+  }
+  for(i = 1; i < argc; i++){
+    if((fd = open(argv[i], O_RDWR)) < 0){
+      printf(2, "compress: cannot open %s\n", argv[i]);
+      continue;
+    }
+    if((n = compress(fd)) < 0)
+      printf(2, "compress: cannot compress %s\n", argv[i]);
+    else
+      printf(1, "%s: %d blocks freed\n", argv[i], n);
+    close(fd);
+  }
+  exit();
+}
@@ -0,0 +1,81 @@
+// defrag: report the number of extents (runs of consecutive
+// disk blocks) that each file is stored in, and move each
+// fragmented file into a single extent.
+// With -n, only report.  With no files, do every file in
+// the current directory.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+int move = 1;
+
+void
+defragfile(char *path)
+{
+  int fd, before, after;
+  struct stat st;
+
+  if((fd = open(path, move ? O_RDWR : O_RDONLY)) < 0){
+    printf(2, "defrag: cannot open %s\n", path);
+    return;
+  }
+  if(fstat(fd, &st) < 0 || st.type != T_FILE){
+    close(fd);
+    return;
+  }
+  if((before = defrag(fd, 0)) < 0){
+    printf(1, "%s: %d bytes, shared blocks\n", path, st.size);
+    close(fd);
+    return;
+  }
+  printf(1, "%s: %d bytes, %d extents", path, st.size, before);
+  if(move && before > 1){
+    if((after = defrag(fd, 1)) < 0)
+      printf(1, ", cannot move");
+    else
+      printf(1, " -> %d", after);
+  }
+  printf(1, "\n");
+  close(fd);
+}
+
+void
+defragdir(void)
+{
+  int fd;
+  struct dirent de;
+  char name[DIRSIZ+1];
+
+  if((fd = open(".", 0)) < 0){
+    printf(2, "defrag: cannot open .\n");
+    return;
+  }
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0)
+      continue;
+    memmove(name, de.name, DIRSIZ);
+    name[DIRSIZ] = 0;
+    defragfile(name);
+  }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  i = 1;
+  if(argc > 1 && strcmp(argv[1], "-n") == 0){
+    move = 0;
+    i++;
+  }
+  if(i == argc)
+    defragdir();
+  for(; i < argc; i++)
+    defragfile(argv[i]);
+  exit();
+}
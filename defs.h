@@ -1,15 +1,31 @@
 struct buf;
 struct context;
+struct diskstat;
 struct file;
 struct inode;
+struct iovec;
+struct ioq;
+struct kmemstat;
+struct pcidev;
 struct pipe;
 struct proc;
 struct spinlock;
 struct stat;
 
+// ahci.c
+void            ahciinit(void);
+int             ahciintr(int);
+void            ahcirw(struct buf*);
+void            ahciprefetch(struct buf*);
+int             ahcictl(int, int, int);
+
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint, uint);
+struct buf*     bnew(uint, uint, uint);
+void            bprefetch(uint, uint, uint);
+void            bforget(uint, uint);
+void            bsetsize(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
@@ -19,6 +35,13 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// diskstat.c
+void            diskstatinit(void);
+void            diskqueued(int, int);
+void            diskdone(struct buf*);
+void            disksync(int, int, uint64);
+void            diskstatread(int, struct diskstat*);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -30,39 +53,69 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filesend(struct file*, struct file*, int, int);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             fileseek(struct file*, int, int);
+int             fileadvise(struct file*, int, int, int);
 
 // fs.c
 int             dirlink(struct inode*, char*, uint);
+uint            dirscan(struct inode*, char**, struct inode**, uint*, int);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, struct inode*);
 struct inode*   idup(struct inode*);
 void            iinit(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            irlock(struct inode*);
+void            irunlock(struct inode*);
+void            renamelock(void);
+void            renameunlock(void);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+uint            imaxsize(struct inode*);
+int             iclone(struct inode*, struct inode*);
+int             idefrag(struct inode*, int);
+int             icompress(struct inode*);
+void            iadvise(struct inode*, uint, uint, int);
+int             ireadpage(struct inode*, uint, char*);
+void            idirty(struct inode*);
+void            isync(void);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             sendi(struct inode*, uint, uint, int (*)(void*, char*, uint), void*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
 // ide.c
 void            ideinit(void);
-void            ideintr(void);
+void            ideintr(int);
 void            iderw(struct buf*);
+void            ideprefetch(struct buf*);
+int             idectl(int, int, int);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
+// iosched.c
+void            ioqinit(struct ioq*, int);
+void            ioqadd(struct ioq*, struct buf*);
+struct buf*     ioqnext(struct ioq*);
+void            ioqdel(struct ioq*, struct buf*);
+struct buf*     ioqtake(struct ioq*, int, int*);
+int             ioqpolicy(struct ioq*, int);
+
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
 void            kinit();
+void            kmemread(struct kmemstat*);
 
 // kbd.c
 void            kbdintr(void);
@@ -75,12 +128,37 @@ void            lapicinit(int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
+// lz.c
+int             lzcompress(char*, uint, char*, uint, ushort*);
+int             lzdecompress(char*, uint, char*, uint);
+
+// mmap.c
+char*           mmap(struct file*, uint, int, int, uint);
+int             munmap(uint, uint);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapexit(struct proc*, pde_t*);
+uint            mmapbottom(struct proc*);
+
 // mp.c
 extern int      ismp;
 int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// pcache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint);
+void            pcachedup(char*);
+void            pcacheput(char*);
+int             pcacheread(struct inode*, char*, uint, uint);
+void            pcachewrite(struct inode*, char*, uint, uint);
+void            pcacheinval(struct inode*);
+
+// pci.c
+int             pcifind(int, int, int, int, int, struct pcidev*);
+uint            pciread(struct pcidev*, uint);
+void            pciwrite(struct pcidev*, uint, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -90,6 +168,8 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipeput(struct pipe*, char*, int);
+int             pipewait(struct pipe*);
 
 // proc.c
 struct proc*    copyproc(struct proc*);
@@ -150,6 +230,13 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+void            virtioinit(void);
+int             virtiointr(int);
+void            virtiorw(struct buf*);
+void            virtioprefetch(struct buf*);
+int             virtioctl(int, int, int);
+
 // vm.c
 void            ksegment(void);
 void            kvmalloc(void);
@@ -162,6 +249,8 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode *, uint, uint);
 pde_t*          copyuvm(pde_t*,uint);
+int             mapuvmpage(pde_t*, uint, uint, int);
+uint            unmapuvmpage(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm();
 
@@ -0,0 +1,41 @@
+// Disk driver settings, read and changed with diskctl(dev, op, val).
+// A negative val only reads the setting.
+
+#define DISK_DMA    1  // move data by bus master DMA (1) or PIO (0)
+#define DISK_MERGE  2  // most sectors one command moves for queued bufs
+#define DISK_SCHED  3  // I/O scheduling policy of the disk's queue
+#define DISK_DEPTH  4  // most requests in flight (virtio, AHCI)
+#define DISK_POLL   5  // status reads to busy-wait for a request
+                       // before sleeping; 0: wait for the interrupt (IDE)
+
+// DISK_SCHED policies
+#define SCHED_FIFO      0  // in arrival order
+#define SCHED_CLOOK     1  // ascending sectors, then back to the lowest
+#define SCHED_DEADLINE  2  // C-LOOK, but serve requests waiting too long first
+#define NSCHED          3
+
+// Statistics of a disk, read with diskstat(dev, &st).
+// Times are in time stamp counter cycles, counted in log2
+// buckets: bucket i counts times from 2^i up to 2^(i+1), and
+// the last bucket all longer ones too.
+#define NLAT     32
+#define NQDEPTH  16
+
+struct diskstat {
+  // Per direction: [0] reads, [1] writes.
+  uint nreq[2];           // bufs read or written
+  uint nsect[2];          // sectors moved
+  uint qlat[2][NLAT];     // time from being queued to going to the disk
+  uint svclat[2][NLAT];   // time from going to the disk to being done
+  uint lat[2][NLAT];      // the whole time
+
+  // Time synchronous reads and writes took, by how the driver
+  // learned they were done: [0] interrupt, [1] polling.
+  uint synclat[2][NLAT];
+
+  // Bufs already waiting in the queue when one was queued.
+  uint nqueued;           // bufs queued
+  uint qsum;              // sum, for the average
+  uint qmax;              // most
+  uint qdepth[NQDEPTH];   // how often each; the last counts deeper too
+};
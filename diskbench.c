@@ -0,0 +1,289 @@
+// diskbench: measure how fast the disk of the current directory
+// writes and reads a file, with and without merging queued
+// requests into one command; for IDE disks, moving data by DMA
+// and then by PIO.
+// With -s, instead compare the I/O schedulers, and with -q
+// the numbers of requests in flight, while NREADER processes
+// read their own files at once; each reports the longest time
+// one of its reads took.  With -p, compare waiting for the
+// disk's interrupt with polling it, on reads that each wait for
+// the disk, and print histograms of the times they took.
+// usage: diskbench [-s | -q | -p] [kbytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "disk.h"
+
+#define NREADER 3
+#define POLLTIME 100000  // status reads to poll for, with -p
+
+int dev;  // the disk of the current directory
+
+char buf[4096];
+
+// Print the rate of moving kb kilobytes in t ticks.
+void
+rate(char *what, int kb, int t)
+{
+  if(t == 0)
+    t = 1;
+  printf(1, "  %s %d KB in %d ticks: %d KB/s\n", what, kb, t, kb * 100 / t);
+}
+
+void
+bench(int kb)
+{
+  int fd, i, t;
+
+  unlink("diskbench.tmp");
+  if((fd = open("diskbench.tmp", O_CREATE|O_RDWR)) < 0){
+    printf(2, "diskbench: cannot create diskbench.tmp\n");
+    exit();
+  }
+  t = uptime();
+  for(i = 0; i < kb; i += 4)
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(2, "diskbench: write failed\n");
+      exit();
+    }
+  rate("write", kb, uptime() - t);
+  close(fd);
+
+  // Read ahead, so that requests queue up to be merged.
+  fd = open("diskbench.tmp", 0);
+  fadvise(fd, 0, 0, FADV_DONTNEED);
+  fadvise(fd, 0, 0, FADV_SEQUENTIAL);
+  t = uptime();
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  rate("read ", kb, uptime() - t);
+  close(fd);
+  unlink("diskbench.tmp");
+}
+
+void
+mkfile(char *name, int kb)
+{
+  int fd, i;
+
+  unlink(name);
+  if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+    printf(2, "diskbench: cannot create %s\n", name);
+    exit();
+  }
+  for(i = 0; i < kb; i += 4)
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(2, "diskbench: write failed\n");
+      exit();
+    }
+  close(fd);
+}
+
+// Read name to the end, and send the longest time
+// a read took, in ticks, to fd.
+void
+reader(char *name, int fd)
+{
+  int rfd, t, t1, max;
+
+  if((rfd = open(name, 0)) < 0){
+    printf(2, "diskbench: cannot open %s\n", name);
+    exit();
+  }
+  fadvise(rfd, 0, 0, FADV_SEQUENTIAL);
+  max = 0;
+  for(t = uptime(); read(rfd, buf, sizeof(buf)) > 0; t = t1)
+    if((t1 = uptime()) - t > max)
+      max = t1 - t;
+  close(rfd);
+  write(fd, &max, sizeof(max));
+  exit();
+}
+
+// Have NREADER processes read diskbench.0, diskbench.1, ...
+// at once, and report the time and the longest read.
+void
+readers(int kb)
+{
+  char name[] = "diskbench.0";
+  int p[2], fd, i, t, max, m;
+
+  for(i = 0; i < NREADER; i++){
+    name[10] = '0' + i;
+    fd = open(name, 0);
+    fadvise(fd, 0, 0, FADV_DONTNEED);
+    close(fd);
+  }
+  pipe(p);
+  t = uptime();
+  for(i = 0; i < NREADER; i++){
+    name[10] = '0' + i;
+    if(fork() == 0){
+      close(p[0]);
+      reader(name, p[1]);
+    }
+  }
+  close(p[1]);
+  max = 0;
+  for(i = 0; i < NREADER; i++){
+    wait();
+    if(read(p[0], &m, sizeof(m)) == sizeof(m) && m > max)
+      max = m;
+  }
+  close(p[0]);
+  rate("read ", NREADER*kb, uptime() - t);
+  printf(1, "  longest read %d ticks\n", max);
+}
+
+void
+mkfiles(int kb, int make)
+{
+  char name[] = "diskbench.0";
+  int i;
+
+  for(i = 0; i < NREADER; i++){
+    name[10] = '0' + i;
+    if(make)
+      mkfile(name, kb);
+    else
+      unlink(name);
+  }
+}
+
+void
+schedbench(int kb)
+{
+  static char *names[NSCHED] = {
+  [SCHED_FIFO]     "fifo",
+  [SCHED_CLOOK]    "c-look",
+  [SCHED_DEADLINE] "deadline",
+  };
+  int s, old;
+
+  mkfiles(kb, 1);
+  old = diskctl(dev, DISK_SCHED, -1);
+  for(s = 0; s < NSCHED; s++){
+    diskctl(dev, DISK_SCHED, s);
+    printf(1, "%s:\n", names[s]);
+    readers(kb);
+  }
+  diskctl(dev, DISK_SCHED, old);
+  mkfiles(kb, 0);
+}
+
+// Compare numbers of requests in flight.
+void
+depthbench(int kb)
+{
+  int d, old;
+
+  if((old = diskctl(dev, DISK_DEPTH, -1)) < 0){
+    printf(1, "disk %d takes one request at a time\n", dev);
+    return;
+  }
+  mkfiles(kb, 1);
+  for(d = 1; diskctl(dev, DISK_DEPTH, d) >= 0; d *= 2){
+    printf(1, "depth %d:\n", d);
+    readers(kb);
+  }
+  diskctl(dev, DISK_DEPTH, old);
+  mkfiles(kb, 0);
+}
+
+// Print the buckets of histogram h that grew since h0.
+void
+printlat(char *what, uint *h, uint *h0)
+{
+  int i;
+
+  printf(1, "  %s:\n", what);
+  for(i = 0; i < NLAT; i++)
+    if(h[i] != h0[i])
+      printf(1, "    2^%d cycles: %d\n", i, h[i] - h0[i]);
+}
+
+// Compare waiting for interrupts with polling.
+void
+pollbench(int kb)
+{
+  static struct diskstat st0, st;
+  int fd, p, t, old;
+
+  if((old = diskctl(dev, DISK_POLL, -1)) < 0){
+    printf(1, "disk %d cannot poll\n", dev);
+    return;
+  }
+  mkfile("diskbench.tmp", kb);
+  for(p = 0; p < 2; p++){
+    diskctl(dev, DISK_POLL, p ? POLLTIME : 0);
+    printf(1, "%s:\n", p ? "polling" : "interrupts");
+    fd = open("diskbench.tmp", 0);
+    fadvise(fd, 0, 0, FADV_DONTNEED);
+    diskstat(dev, &st0);
+    t = uptime();
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    rate("read ", kb, uptime() - t);
+    diskstat(dev, &st);
+    close(fd);
+    printlat("reads woken by the interrupt", st.synclat[0], st0.synclat[0]);
+    printlat("reads that polled", st.synclat[1], st0.synclat[1]);
+  }
+  diskctl(dev, DISK_POLL, old);
+  unlink("diskbench.tmp");
+}
+
+// Run bench with and without merging requests.
+void
+mergebench(char *what, int kb)
+{
+  int merge;
+
+  printf(1, "%s:\n", what);
+  bench(kb);
+  merge = diskctl(dev, DISK_MERGE, 0);
+  printf(1, "%s, no merging:\n", what);
+  bench(kb);
+  diskctl(dev, DISK_MERGE, merge);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb, dma;
+  struct stat st;
+
+  if(stat(".", &st) < 0){
+    printf(2, "diskbench: cannot stat .\n");
+    exit();
+  }
+  dev = st.dev;
+  if(argc > 1 && strcmp(argv[1], "-s") == 0){
+    schedbench(argc > 2 ? atoi(argv[2]) : 32);
+    exit();
+  }
+  if(argc > 1 && strcmp(argv[1], "-q") == 0){
+    depthbench(argc > 2 ? atoi(argv[2]) : 32);
+    exit();
+  }
+  if(argc > 1 && strcmp(argv[1], "-p") == 0){
+    pollbench(argc > 2 ? atoi(argv[2]) : 32);
+    exit();
+  }
+  kb = argc > 1 ? atoi(argv[1]) : 64;
+  if(diskctl(dev, DISK_DMA, -1) < 0){  // not IDE
+    mergebench("disk", kb);
+    exit();
+  }
+  if((dma = diskctl(dev, DISK_DMA, 1)) < 0)
+    printf(1, "no DMA controller\n");
+  else
+    mergebench("DMA", kb);
+  diskctl(dev, DISK_DMA, 0);
+  mergebench("PIO", kb);
+  if(dma >= 0)
+    diskctl(dev, DISK_DMA, dma);
+  exit();
+}
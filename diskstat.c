@@ -0,0 +1,92 @@
+// Disk statistics, for the diskstat system call.
+//
+// The I/O scheduler (iosched.c) stamps each buf when it is
+// queued and sent to the disk, and the driver calls diskdone
+// when it is done.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "buf.h"
+#include "disk.h"
+
+struct {
+  struct spinlock lock;
+  struct diskstat st[NDISK];
+} dstat;
+
+void
+diskstatinit(void)
+{
+  initlock(&dstat.lock, "diskstat");
+}
+
+// The log2 bucket of t; the last bucket takes all longer times.
+static int
+latbucket(uint64 t)
+{
+  int i;
+
+  for(i = 0; t > 1 && i < NLAT-1; t >>= 1)
+    i++;
+  return i;
+}
+
+// Count a buf queued for dev, which found n bufs waiting.
+void
+diskqueued(int dev, int n)
+{
+  struct diskstat *st;
+
+  acquire(&dstat.lock);
+  st = &dstat.st[dev];
+  st->nqueued++;
+  st->qsum += n;
+  if(n > st->qmax)
+    st->qmax = n;
+  st->qdepth[n < NQDEPTH ? n : NQDEPTH-1]++;
+  release(&dstat.lock);
+}
+
+// Count b, which the disk has just read or written.
+// Call before clearing B_DIRTY.
+void
+diskdone(struct buf *b)
+{
+  struct diskstat *st;
+  uint64 t;
+  int w;
+
+  t = rdtsc();
+  w = (b->flags & B_DIRTY) != 0;
+  acquire(&dstat.lock);
+  st = &dstat.st[b->dev];
+  st->nreq[w]++;
+  st->nsect[w] += b->bsize / SECTSIZE;
+  st->qlat[w][latbucket(b->tstart - b->tqueue)]++;
+  st->svclat[w][latbucket(t - b->tstart)]++;
+  st->lat[w][latbucket(t - b->tqueue)]++;
+  release(&dstat.lock);
+}
+
+// Count a synchronous request to dev that took t cycles,
+// and whose completion the driver found by polling if polled.
+void
+disksync(int dev, int polled, uint64 t)
+{
+  acquire(&dstat.lock);
+  dstat.st[dev].synclat[polled != 0][latbucket(t)]++;
+  release(&dstat.lock);
+}
+
+// Copy the statistics of dev to st.
+void
+diskstatread(int dev, struct diskstat *st)
+{
+  acquire(&dstat.lock);
+  *st = dstat.st[dev];
+  release(&dstat.lock);
+}
@@ -3,6 +3,9 @@
 #include "mmu.h"
 #include "proc.h"
 #include "defs.h"
+#include "stat.h"
+#include "fs.h"
+#include "file.h"
 #include "x86.h"
 #include "elf.h"
 
@@ -22,9 +25,11 @@ exec(char *path, char **argv)
 
   if((ip = namei(path)) == 0)
     return -1;
-  ilock(ip);
+  irlock(ip);  // other processes may run the same file
 
   // Check ELF header
+  if(ip->type != T_FILE)
+    goto bad;
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) < sizeof(elf))
     goto bad;
   if(elf.magic != ELF_MAGIC)
@@ -46,7 +51,9 @@ exec(char *path, char **argv)
     if(!loaduvm(pgdir, (char *)ph.va, ip, ph.offset, ph.filesz))
       goto bad;
   }
-  iunlockput(ip);
+  irunlock(ip);
+  iput(ip);
+  ip = 0;
 
   // Allocate and initialize stack at sz
   sz = spbottom = PGROUNDUP(sz);
@@ -95,12 +102,16 @@ exec(char *path, char **argv)
 
   switchuvm(proc); 
 
+  mmapexit(proc, oldpgdir);
   freevm(oldpgdir);
 
   return 0;
 
  bad:
   if(pgdir) freevm(pgdir);
-  iunlockput(ip);
+  if(ip){
+    irunlock(ip);
+    iput(ip);
+  }
   return -1;
 }
@@ -2,3 +2,28 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+
+// lseek whence
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
+
+// Segment for readv and writev
+struct iovec {
+  void *base;
+  int len;
+};
+#define IOV_MAX  16  // most segments per readv/writev
+
+// mmap protection and flags
+#define PROT_READ    0x1
+#define PROT_WRITE   0x2
+#define MAP_SHARED   0x1
+#define MAP_PRIVATE  0x2
+
+// fadvise access hints
+#define FADV_NORMAL      0
+#define FADV_SEQUENTIAL  1  // read ahead of each read
+#define FADV_WILLNEED    2  // start reading the range now
+#define FADV_DONTNEED    3  // cached blocks of the range may go
+#define FADV_NOREUSE     4  // blocks are read once: recycle them first
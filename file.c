@@ -1,9 +1,11 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "file.h"
 #include "spinlock.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -76,29 +78,69 @@ int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    irlock(f->ip);
     stati(f->ip, st);
-    iunlock(f->ip);
+    irunlock(f->ip);
     return 0;
   }
   return -1;
 }
 
+// Lock f's inode for a read, at f->off if atoff.
+// Readers share the lock, except that reads at the offset
+// of a file shared with another process are serialized so
+// that each gets its own bytes, and devices, whose read
+// routines unlock the inode while they wait, lock it
+// exclusively.  Returns 1 if the lock is shared.
+static int
+ireadlock(struct file *f, int atoff)
+{
+  irlock(f->ip);
+  if(f->ip->type != T_DEV && !(atoff && f->ref > 1))
+    return 1;
+  irunlock(f->ip);
+  ilock(f->ip);
+  return 0;
+}
+
+static void
+ireadunlock(struct file *f, int shared)
+{
+  if(shared)
+    irunlock(f->ip);
+  else
+    iunlock(f->ip);
+}
+
+// Act on f's standing access hints after reading n bytes at off.
+static void
+readadvise(struct file *f, uint off, int n)
+{
+  if(n <= 0)
+    return;
+  if(f->advice & (1<<FADV_SEQUENTIAL))
+    iadvise(f->ip, off, n, FADV_SEQUENTIAL);
+  if(f->advice & (1<<FADV_NOREUSE))
+    iadvise(f->ip, off, n, FADV_NOREUSE);
+}
+
 // Read from file f.  Addr is kernel address.
 int
 fileread(struct file *f, char *addr, int n)
 {
-  int r;
+  int r, shared;
 
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    shared = ireadlock(f, 1);
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      readadvise(f, f->off, r);
       f->off += r;
-    iunlock(f->ip);
+    }
+    ireadunlock(f, shared);
     return r;
   }
   panic("fileread");
@@ -123,3 +165,256 @@ filewrite(struct file *f, char *addr, int n)
   }
   panic("filewrite");
 }
+
+// Read into the segments of iov from f, at offset off, or at
+// f->off (advancing it) if off < 0.  The inode stays locked
+// across all segments.  Segment addresses are kernel addresses.
+// Returns the total read, which stops at the first short segment.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int i, r, tot, shared;
+  uint o;
+
+  if(f->readable == 0)
+    return -1;
+  tot = 0;
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    for(i = 0; i < cnt; i++){
+      if((r = piperead(f->pipe, iov[i].base, iov[i].len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    return tot;
+  }
+  if(f->type == FD_INODE){
+    shared = ireadlock(f, off < 0);
+    o = off < 0 ? f->off : off;
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, iov[i].base, o, iov[i].len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      tot += r;
+      o += r;
+      if(r < iov[i].len)
+        break;
+    }
+    if(tot > 0)
+      readadvise(f, o - tot, tot);
+    if(off < 0)
+      f->off = o;
+    ireadunlock(f, shared);
+    return tot;
+  }
+  panic("filereadv");
+}
+
+// Write the segments of iov to f; see filereadv.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int i, r, tot;
+  uint o;
+
+  if(f->writable == 0)
+    return -1;
+  tot = 0;
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    for(i = 0; i < cnt; i++){
+      if((r = pipewrite(f->pipe, iov[i].base, iov[i].len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+    }
+    return tot;
+  }
+  if(f->type == FD_INODE){
+    ilock(f->ip);
+    o = off < 0 ? f->off : off;
+    for(i = 0; i < cnt; i++){
+      if((r = writei(f->ip, iov[i].base, o, iov[i].len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      tot += r;
+      o += r;
+      if(r < iov[i].len)
+        break;
+    }
+    if(off < 0)
+      f->off = o;
+    iunlock(f->ip);
+    return tot;
+  }
+  panic("filewritev");
+}
+
+// Set the offset of f.  Returns the new offset, or -1.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    base = 0;
+  else if(whence == SEEK_CUR)
+    base = f->off;
+  else if(whence == SEEK_END)
+    base = f->ip->size;
+  else {
+    iunlock(f->ip);
+    return -1;
+  }
+  // Seeking past the end is allowed; a later write
+  // leaves a hole between the old end and the offset.
+  if(base + off < 0){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = base + off;
+  iunlock(f->ip);
+  return f->off;
+}
+
+// Sinks for filesend: append a piece of a cache buffer
+// to an inode at the file's offset, or to a pipe.
+static int
+inodesink(void *arg, char *src, uint n)
+{
+  struct file *f = arg;
+  int r;
+
+  if((r = writei(f->ip, src, f->off, n)) > 0)
+    f->off += r;
+  return r;
+}
+
+// The pipe sink takes what fits and notes that the pipe
+// filled, rather than sleeping under a cache buffer.
+struct pipesend {
+  struct pipe *p;
+  int full;
+};
+
+static int
+pipesink(void *arg, char *src, uint n)
+{
+  struct pipesend *s = arg;
+  int r;
+
+  if((r = pipeput(s->p, src, n)) >= 0 && r < n)
+    s->full = 1;
+  return r;
+}
+
+// Copy n bytes from in to out inside the kernel, feeding
+// in's cache buffers directly to out without a user buffer.
+// Reads in at off, or at in->off (advancing it) if off < 0.
+// Writes out at out->off.  in must be an inode; out may be
+// an inode or a pipe.  Between inodes, both stay locked for the
+// whole transfer, so it is atomic with respect to other file I/O.
+// To a pipe, the data goes as far as the pipe has room; then
+// filesend waits for the reader with no buffer or inode locked,
+// since the process draining the pipe may need them.
+int
+filesend(struct file *out, struct file *in, int off, int n)
+{
+  struct inode *ip, *op;
+  struct pipesend s;
+  int r, m, shared;
+  uint pos;
+
+  if(in->readable == 0 || out->writable == 0 || in->type != FD_INODE)
+    return -1;
+  ip = in->ip;
+  if(out->type == FD_PIPE){
+    if(ip->type == T_DEV)
+      return -1;
+    s.p = out->pipe;
+    r = 0;
+    for(;;){
+      s.full = 0;
+      shared = ireadlock(in, off < 0);
+      pos = off < 0 ? in->off : off + r;
+      m = sendi(ip, pos, n - r, pipesink, &s);
+      if(m > 0){
+        readadvise(in, pos, m);
+        if(off < 0)
+          in->off += m;  // only what the pipe took
+        r += m;
+      }
+      ireadunlock(in, shared);
+      if(!s.full)
+        break;  // all sent, end of file, or no reader
+      if(pipewait(s.p) < 0){
+        m = -1;
+        break;
+      }
+    }
+    if(r == 0 && m < 0)
+      return -1;
+    return r;
+  } else if(out->type == FD_INODE){
+    op = out->ip;
+    if(op == ip)
+      return -1;
+    // Lock in address order so that two opposite
+    // transfers cannot deadlock.
+    if(ip < op){
+      ilock(ip);
+      ilock(op);
+    } else {
+      ilock(op);
+      ilock(ip);
+    }
+    r = sendi(ip, off < 0 ? in->off : off, n, inodesink, out);
+    readadvise(in, off < 0 ? in->off : off, r);
+    iunlock(op);
+    iunlock(ip);
+  } else
+    return -1;
+
+  if(r > 0 && off < 0)
+    in->off += r;
+  return r;
+}
+
+// Give the kernel a hint (FADV_*) about how f will be read.
+// SEQUENTIAL and NOREUSE apply to later reads through f, until
+// NORMAL; WILLNEED and DONTNEED act on len bytes at off now
+// (to the end of the file if len is 0).
+int
+fileadvise(struct file *f, int off, int len, int advice)
+{
+  if(f->type != FD_INODE || off < 0 || len < 0)
+    return -1;
+  switch(advice){
+  case FADV_NORMAL:
+    f->advice = 0;
+    break;
+  case FADV_SEQUENTIAL:
+  case FADV_NOREUSE:
+    f->advice |= 1<<advice;
+    break;
+  case FADV_WILLNEED:
+  case FADV_DONTNEED:
+    irlock(f->ip);
+    iadvise(f->ip, off, len ? len : f->ip->size, advice);
+    irunlock(f->ip);
+    break;
+  default:
+    return -1;
+  }
+  return 0;
+}
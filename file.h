@@ -6,6 +6,7 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  int advice;  // 1<<FADV_SEQUENTIAL, 1<<FADV_NOREUSE
 };
 
 
@@ -15,9 +16,12 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  int flags;          // I_BUSY, I_VALID
+  int flags;          // I_BUSY, I_VALID, I_DIRTY, I_WANT
+  int readers;        // processes holding irlock
+  struct inode *dnext; // next inode on the dirty list
 
   short type;         // copy of disk inode
+  short attr;
   short major;
   short minor;
   short nlink;
@@ -27,6 +31,8 @@ struct inode {
 
 #define I_BUSY 0x1
 #define I_VALID 0x2
+#define I_DIRTY 0x4  // in-core copy is newer than the disk inode
+#define I_WANT 0x8   // a process is waiting in ilock
 
 
 // device implementations
@@ -4,7 +4,9 @@
 //   + Directories: inode with special contents (list of other inodes!)
 //   + Names: paths like /usr/rtm/xv6/fs.c for convenient naming.
 //
-// Disk layout is: superblock, inodes, block in-use bitmap, data blocks.
+// Disk layout is: superblock, then block groups, each holding
+// inodes, a block in-use bitmap, block reference counts, and
+// data blocks.
 //
 // This file contains the low-level file system manipulation 
 // routines.  The (higher-level) system call implementations
@@ -20,54 +22,141 @@
 #include "buf.h"
 #include "fs.h"
 #include "file.h"
+#include "fcntl.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static char zeroblock[MAXBSIZE];  // contents of a hole
 
-// Read the super block.
+// Read the super block, and switch the buffer cache
+// to the block size it gives.
 static void
 readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
   
-  bp = bread(dev, 1, 0);
+  bp = bread(dev, SBSECT, 0);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
+  if(sb->bsize < SECTSIZE || sb->bsize > MAXBSIZE || (sb->bsize & (sb->bsize-1)))
+    panic("readsb: bad block size");
+  bsetsize(dev, sb->bsize);
 }
 
-// Zero a block.
-static void
-bzero(int dev, int bno)
+// Super block and per-group usage of the file system, read
+// from disk on first use.  The usage counts only steer block
+// and inode placement; they are not written back to disk.
+// There is one file system, so one device's worth is kept.
+static struct {
+  struct spinlock lock;
+  int loading;          // a getsb is counting the groups
+  int loaded;
+  uint dev;             // device loaded
+  struct superblock sb;
+  struct {
+    uint nbfree;        // free blocks
+    uint nifree;        // free inodes
+    uint ndirs;         // directories
+  } g[MAXGROUPS];
+} fsinfo;
+
+// Return the super block of dev, loading it and counting
+// the usage of each group if necessary.  Others wanting it
+// meanwhile wait for the first caller to finish.
+static struct superblock*
+getsb(uint dev)
 {
+  struct superblock *sb;
   struct buf *bp;
-  
-  bp = bread(dev, bno, 0);
-  memset(bp->data, 0, BSIZE);
-  bwrite(bp);
-  brelse(bp);
+  struct dinode *dip;
+  uint g, k, len, inum;
+
+  if(fsinfo.loaded && fsinfo.dev == dev)
+    return &fsinfo.sb;
+
+  acquire(&fsinfo.lock);
+  while(fsinfo.loading)
+    sleep(&fsinfo, &fsinfo.lock);
+  if(fsinfo.loaded){
+    if(fsinfo.dev != dev)
+      panic("getsb: second file system");
+    release(&fsinfo.lock);
+    return &fsinfo.sb;
+  }
+  fsinfo.loading = 1;
+  release(&fsinfo.lock);
+
+  sb = &fsinfo.sb;
+  readsb(dev, sb);
+  if(sb->ngroups > MAXGROUPS || sb->bpg > BPB(sb) || sb->bpg*sizeof(ushort) > sb->bsize)
+    panic("getsb: bad super block");
+  for(g = 0; g < sb->ngroups; g++){
+    fsinfo.g[g].nbfree = 0;
+    fsinfo.g[g].nifree = 0;
+    fsinfo.g[g].ndirs = 0;
+    len = min(sb->bpg, sb->size - GSTART(g, sb));
+    bp = bread(dev, BBLOCK(g, sb), 0);
+    for(k = 0; k < len; k++)
+      if((bp->data[k/8] & (1 << (k%8))) == 0)
+        fsinfo.g[g].nbfree++;
+    brelse(bp);
+    for(inum = g*sb->ipg; inum < (g+1)*sb->ipg; inum += IPB(sb)){
+      bp = bread(dev, IBLOCK(inum, sb), 0);
+      for(k = 0; k < IPB(sb); k++){
+        dip = (struct dinode*)bp->data + k;
+        if(inum + k == 0)
+          continue;
+        if(dip->type == 0)
+          fsinfo.g[g].nifree++;
+        else if(dip->type == T_DIR)
+          fsinfo.g[g].ndirs++;
+      }
+      brelse(bp);
+    }
+  }
+  acquire(&fsinfo.lock);
+  fsinfo.dev = dev;
+  fsinfo.loaded = 1;
+  fsinfo.loading = 0;
+  wakeup(&fsinfo);
+  release(&fsinfo.lock);
+  return sb;
 }
 
 // Blocks. 
 
-// Allocate a disk block.
+// Allocate a disk block, as close after goal as possible:
+// first in goal's group, then in the groups that follow it.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  uint g, g0, i, k, k0, len, n;
+  int m;
   struct buf *bp;
-  struct superblock sb;
-
-  bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes), 0);
-    for(bi = 0; bi < BPB; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use on disk.
+  struct superblock *sb;
+
+  sb = getsb(dev);
+  if(goal < GDATA(0, sb) || goal >= sb->size)
+    goal = GDATA(0, sb);
+  g0 = BGROUP(goal, sb);
+  for(i = 0; i < sb->ngroups; i++){
+    g = (g0 + i) % sb->ngroups;
+    if(fsinfo.g[g].nbfree == 0)
+      continue;
+    len = min(sb->bpg, sb->size - GSTART(g, sb));
+    k0 = (i == 0) ? goal - GSTART(g, sb) : 0;
+    bp = bread(dev, BBLOCK(g, sb), 0);
+    for(n = 0; n < len; n++){
+      k = (k0 + n) % len;
+      m = 1 << (k % 8);
+      if((bp->data[k/8] & m) == 0){  // Is block free?
+        bp->data[k/8] |= m;  // Mark block in use on disk.
         bwrite(bp);
         brelse(bp);
-        return b + bi;
+        acquire(&fsinfo.lock);
+        fsinfo.g[g].nbfree--;
+        release(&fsinfo.lock);
+        return GSTART(g, sb) + k;
       }
     }
     brelse(bp);
@@ -75,25 +164,192 @@ balloc(uint dev)
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
-static void
-bfree(int dev, uint b)
+// Allocate n consecutive free blocks, in group g0 if it has
+// such a run, else in the first group after it that does.
+// Returns the first block of the run, or 0 if there is none.
+static uint
+ballocrun(uint dev, uint g0, uint n)
 {
+  uint g, i, j, k, len, run;
   struct buf *bp;
-  struct superblock sb;
-  int bi, m;
+  struct superblock *sb;
+
+  sb = getsb(dev);
+  for(i = 0; i < sb->ngroups; i++){
+    g = (g0 + i) % sb->ngroups;
+    if(fsinfo.g[g].nbfree < n)
+      continue;
+    len = min(sb->bpg, sb->size - GSTART(g, sb));
+    bp = bread(dev, BBLOCK(g, sb), 0);
+    run = 0;
+    for(k = 0; k < len; k++){
+      if(bp->data[k/8] & (1 << (k%8))){
+        run = 0;
+        continue;
+      }
+      if(++run < n)
+        continue;
+      for(j = k+1-n; j <= k; j++)
+        bp->data[j/8] |= 1 << (j%8);
+      bwrite(bp);
+      brelse(bp);
+      acquire(&fsinfo.lock);
+      fsinfo.g[g].nbfree -= n;
+      release(&fsinfo.lock);
+      return GSTART(g, sb) + k+1-n;
+    }
+    brelse(bp);
+  }
+  return 0;
+}
+
+// Freeing blocks.
+//
+// Freed blocks are not zeroed; bmap zeroes a block when it is
+// allocated again (see bnew).  Frees are batched: consecutive
+// frees that fall in the same group clear bits in one bitmap
+// buffer, which is written once when the batch moves on to
+// another group or is flushed.
+
+struct bfreebatch {
+  uint dev;
+  uint g;             // group of bp
+  struct buf *bp;     // bitmap block being updated, or 0
+  uint nfreed;        // blocks freed in bp
+};
 
-  bzero(dev, b);
+static void
+bfreeflush(struct bfreebatch *fb)
+{
+  if(fb->bp == 0)
+    return;
+  bwrite(fb->bp);
+  brelse(fb->bp);
+  fb->bp = 0;
+  acquire(&fsinfo.lock);
+  fsinfo.g[fb->g].nbfree += fb->nfreed;
+  release(&fsinfo.lock);
+}
 
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes), 0);
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
+static void
+bfreeadd(struct bfreebatch *fb, uint b)
+{
+  struct superblock *sb;
+  uint g, k;
+  int m;
+
+  sb = getsb(fb->dev);
+  g = BGROUP(b, sb);
+  if(fb->bp == 0 || fb->g != g){
+    bfreeflush(fb);
+    fb->g = g;
+    fb->bp = bread(fb->dev, BBLOCK(g, sb), 0);
+    fb->nfreed = 0;
+  }
+  k = b - GSTART(g, sb);
+  m = 1 << (k % 8);
+  if((fb->bp->data[k/8] & m) == 0)
     panic("freeing free block");
-  bp->data[bi/8] &= ~m;  // Mark block free on disk.
+  fb->bp->data[k/8] &= ~m;  // Mark block free on disk.
+  fb->nfreed++;
+}
+
+// Shared blocks.
+//
+// After clone, a block can belong to several files.  Each group
+// has a reference count block after its bitmap, holding a ushort
+// per block of the group that counts the owners beyond the first;
+// a block is freed only when its count is zero.  An indirect
+// block is a single owner of the blocks it lists, so a shared
+// indirect block must be copied before any of them can change.
+// There are fewer owners than inodes, so counts cannot overflow.
+
+// Add delta to the count of each non-zero block in b[0..n-1].
+static void
+brefadd(uint dev, uint *b, uint n, int delta)
+{
+  struct superblock *sb;
+  struct buf *bp;
+  ushort *r;
+  uint i, g;
+
+  sb = getsb(dev);
+  bp = 0;
+  for(i = 0; i < n; i++){
+    if(b[i] == 0)
+      continue;
+    g = BGROUP(b[i], sb);
+    if(bp == 0 || bp->sector != RBLOCK(g, sb)){
+      if(bp){
+        bwrite(bp);
+        brelse(bp);
+      }
+      bp = bread(dev, RBLOCK(g, sb), 0);
+    }
+    r = (ushort*)bp->data + (b[i] - GSTART(g, sb));
+    if((delta < 0 && *r < -delta) || (delta > 0 && *r + delta > 0xffff))
+      panic("brefadd");
+    *r += delta;
+  }
+  if(bp){
+    bwrite(bp);
+    brelse(bp);
+  }
+}
+
+// Does block b have more than one owner?
+static int
+bshared(uint dev, uint b)
+{
+  struct superblock *sb;
+  struct buf *bp;
+  uint g;
+  int n;
+
+  sb = getsb(dev);
+  g = BGROUP(b, sb);
+  bp = bread(dev, RBLOCK(g, sb), 0);
+  n = ((ushort*)bp->data)[b - GSTART(g, sb)];
+  brelse(bp);
+  return n != 0;
+}
+
+// Drop one owner of block b.  Returns 0 if that was
+// the last owner, in which case the caller frees b.
+static int
+bunref(uint dev, uint b)
+{
+  struct superblock *sb;
+  struct buf *bp;
+  ushort *r;
+  uint g;
+
+  sb = getsb(dev);
+  g = BGROUP(b, sb);
+  bp = bread(dev, RBLOCK(g, sb), 0);
+  r = (ushort*)bp->data + (b - GSTART(g, sb));
+  if(*r == 0){
+    brelse(bp);
+    return 0;
+  }
+  (*r)--;
   bwrite(bp);
   brelse(bp);
+  return 1;
+}
+
+// Drop one owner of block b, freeing b if it was the last.
+static void
+bdrop(uint dev, uint b)
+{
+  struct bfreebatch fb;
+
+  if(bunref(dev, b))
+    return;
+  fb.dev = dev;
+  fb.bp = 0;
+  bfreeadd(&fb, b);
+  bfreeflush(&fb);
 }
 
 // Inodes.
@@ -116,6 +372,9 @@ bfree(int dev, uint b)
 // Processes are only allowed to read and write inode
 // metadata and contents when holding the inode's lock,
 // represented by the I_BUSY flag in the in-memory copy.
+// Processes that only read may instead share the lock
+// (irlock), counted in ip->readers; a process waiting in
+// ilock sets I_WANT to hold off new readers.
 // Because inode locks are held during disk accesses, 
 // they are implemented using a flag rather than with
 // spin locks.  Callers are responsible for locking
@@ -123,6 +382,13 @@ bfree(int dev, uint b)
 // this responsibility with the caller makes it possible for them
 // to create arbitrarily-sized atomic operations.
 //
+// Changes that only grow a file (its size and block addresses)
+// are not written to disk at once: idirty marks the inode
+// I_DIRTY and puts it on icache.dirty.  A dirty inode is written
+// when its last reference is dropped, by sync, or by iupdate of
+// any inode in the same disk block; each write of an inode block
+// carries every dirty inode in it.
+//
 // To give maximum control over locking to the callers, 
 // the routines in this file that return inode pointers 
 // return pointers to *unlocked* inodes.  It is the callers'
@@ -132,60 +398,185 @@ bfree(int dev, uint b)
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *dirty;  // dirty inodes, linked by dnext
+  int renaming;         // a rename holds the rename lock
 } icache;
 
 void
 iinit(void)
 {
   initlock(&icache.lock, "icache");
+  initlock(&fsinfo.lock, "fsinfo");
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Choose a group for a new directory: among the groups with
+// an above-average number of free inodes, the one with the
+// fewest directories, so that directory trees spread out
+// over the disk and leave room near each for its files.
+static uint
+dirgroup(struct superblock *sb)
+{
+  uint g, best, avg;
+
+  avg = 0;
+  for(g = 0; g < sb->ngroups; g++)
+    avg += fsinfo.g[g].nifree;
+  avg /= sb->ngroups;
+  best = 0;
+  for(g = 0; g < sb->ngroups; g++){
+    if(fsinfo.g[g].nifree == 0 || fsinfo.g[g].nifree < avg)
+      continue;
+    if(fsinfo.g[best].nifree < avg ||
+       fsinfo.g[g].ndirs < fsinfo.g[best].ndirs ||
+       (fsinfo.g[g].ndirs == fsinfo.g[best].ndirs &&
+        fsinfo.g[g].nbfree > fsinfo.g[best].nbfree))
+      best = g;
+  }
+  return best;
+}
+
 // Allocate a new inode with the given type on device dev.
+// A directory goes to a lightly used group; anything else
+// goes to the group of its parent directory dp, if possible.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, struct inode *dp)
 {
-  int inum;
+  uint g, g0, i, inum, k;
   struct buf *bp;
   struct dinode *dip;
-  struct superblock sb;
+  struct superblock *sb;
 
-  readsb(dev, &sb);
-  for(inum = 1; inum < sb.ninodes; inum++){  // loop over inode blocks
-    bp = bread(dev, IBLOCK(inum), 0);
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      bwrite(bp);   // mark it allocated on the disk
+  sb = getsb(dev);
+  if(type == T_DIR)
+    g0 = dirgroup(sb);
+  else
+    g0 = dp ? IGROUP(dp->inum, sb) : 0;
+  for(i = 0; i < sb->ngroups; i++){
+    g = (g0 + i) % sb->ngroups;
+    if(fsinfo.g[g].nifree == 0)
+      continue;
+    for(inum = g*sb->ipg; inum < (g+1)*sb->ipg; inum += IPB(sb)){  // loop over inode blocks
+      bp = bread(dev, IBLOCK(inum, sb), 0);
+      for(k = 0; k < IPB(sb); k++){
+        dip = (struct dinode*)bp->data + k;
+        if(inum + k == 0 || dip->type != 0)
+          continue;
+        // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        bwrite(bp);   // mark it allocated on the disk
+        brelse(bp);
+        acquire(&fsinfo.lock);
+        fsinfo.g[g].nifree--;
+        if(type == T_DIR)
+          fsinfo.g[g].ndirs++;
+        release(&fsinfo.lock);
+        return iget(dev, inum + k);
+      }
       brelse(bp);
-      return iget(dev, inum);
     }
-    brelse(bp);
   }
   panic("ialloc: no inodes");
 }
 
-// Copy inode, which has changed, from memory to disk.
-void
-iupdate(struct inode *ip)
+// Account for the freeing of inode ip, which had type type.
+static void
+ifree(struct inode *ip, short type)
+{
+  uint g;
+
+  g = IGROUP(ip->inum, getsb(ip->dev));
+  acquire(&fsinfo.lock);
+  fsinfo.g[g].nifree++;
+  if(type == T_DIR)
+    fsinfo.g[g].ndirs--;
+  release(&fsinfo.lock);
+}
+
+// Copy the in-core fields of ip into its slot in inode block bp.
+static void
+icopy(struct inode *ip, struct buf *bp)
 {
-  struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum), ip->inum);
-  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  dip = (struct dinode*)bp->data + ip->inum%IPB(getsb(ip->dev));
   dip->type = ip->type;
+  dip->attr = ip->attr;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+}
+
+// Copy inode, which has changed, from memory to disk.
+// The same block write also cleans every other dirty inode
+// in the block that is not locked; a locked one may be in
+// the middle of a change and is left for later.
+void
+iupdate(struct inode *ip)
+{
+  struct buf *bp;
+  struct inode **pp, *jp;
+  struct superblock *sb;
+  uint bno;
+
+  sb = getsb(ip->dev);
+  bno = IBLOCK(ip->inum, sb);
+  bp = bread(ip->dev, bno, ip->inum);
+  acquire(&icache.lock);
+  icopy(ip, bp);
+  for(pp = &icache.dirty; (jp = *pp) != 0; ){
+    if(jp == ip || (jp->dev == ip->dev && IBLOCK(jp->inum, sb) == bno &&
+                    !(jp->flags & I_BUSY))){
+      icopy(jp, bp);
+      jp->flags &= ~I_DIRTY;
+      *pp = jp->dnext;
+    } else
+      pp = &jp->dnext;
+  }
+  release(&icache.lock);
   bwrite(bp);
   brelse(bp);
 }
 
+// Note that locked inode ip has changed in memory,
+// to be written to disk later.
+void
+idirty(struct inode *ip)
+{
+  acquire(&icache.lock);
+  if(!(ip->flags & I_DIRTY)){
+    ip->flags |= I_DIRTY;
+    ip->dnext = icache.dirty;
+    icache.dirty = ip;
+  }
+  release(&icache.lock);
+}
+
+// Write all dirty inodes to disk.
+void
+isync(void)
+{
+  struct inode *ip;
+
+  for(;;){
+    acquire(&icache.lock);
+    if((ip = icache.dirty) == 0){
+      release(&icache.lock);
+      return;
+    }
+    ip->ref++;
+    release(&icache.lock);
+    ilock(ip);
+    if(ip->flags & I_DIRTY)
+      iupdate(ip);
+    iunlockput(ip);
+  }
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy.
 static struct inode*
@@ -238,20 +629,25 @@ ilock(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
+  struct superblock *sb;
 
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
   acquire(&icache.lock);
-  while(ip->flags & I_BUSY)
+  while((ip->flags & I_BUSY) || ip->readers > 0){
+    ip->flags |= I_WANT;
     sleep(ip, &icache.lock);
-  ip->flags |= I_BUSY;
+  }
+  ip->flags = (ip->flags | I_BUSY) & ~I_WANT;
   release(&icache.lock);
 
   if(!(ip->flags & I_VALID)){
-    bp = bread(ip->dev, IBLOCK(ip->inum), ip->inum);
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
+    sb = getsb(ip->dev);
+    bp = bread(ip->dev, IBLOCK(ip->inum, sb), ip->inum);
+    dip = (struct dinode*)bp->data + ip->inum%IPB(sb);
     ip->type = dip->type;
+    ip->attr = dip->attr;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
@@ -264,6 +660,28 @@ ilock(struct inode *ip)
   }
 }
 
+// The rename lock serializes renames, so that the shape of
+// the directory tree cannot change while a rename that moves
+// a directory checks that it is not moving it into itself.
+void
+renamelock(void)
+{
+  acquire(&icache.lock);
+  while(icache.renaming)
+    sleep(&icache.renaming, &icache.lock);
+  icache.renaming = 1;
+  release(&icache.lock);
+}
+
+void
+renameunlock(void)
+{
+  acquire(&icache.lock);
+  icache.renaming = 0;
+  wakeup(&icache.renaming);
+  release(&icache.lock);
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
@@ -277,6 +695,39 @@ iunlock(struct inode *ip)
   release(&icache.lock);
 }
 
+// Lock the given inode for reading only, sharing the lock
+// with other readers.  The holder may call readi and stati
+// but must not change ip.
+void
+irlock(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("irlock");
+
+  if(!(ip->flags & I_VALID)){
+    ilock(ip);
+    iunlock(ip);
+  }
+  acquire(&icache.lock);
+  while(ip->flags & (I_BUSY|I_WANT))
+    sleep(ip, &icache.lock);
+  ip->readers++;
+  release(&icache.lock);
+}
+
+// Release a lock taken by irlock.
+void
+irunlock(struct inode *ip)
+{
+  if(ip == 0 || ip->readers < 1 || ip->ref < 1)
+    panic("irunlock");
+
+  acquire(&icache.lock);
+  if(--ip->readers == 0)
+    wakeup(ip);
+  release(&icache.lock);
+}
+
 // Caller holds reference to unlocked ip.  Drop reference.
 void
 iput(struct inode *ip)
@@ -289,11 +740,22 @@ iput(struct inode *ip)
     ip->flags |= I_BUSY;
     release(&icache.lock);
     itrunc(ip);
+    ifree(ip, ip->type);
     ip->type = 0;
     iupdate(ip);
     acquire(&icache.lock);
     ip->flags = 0;
     wakeup(ip);
+  } else if(ip->ref == 1 && (ip->flags & I_DIRTY)){
+    // last reference: write back before the slot can be reused.
+    if(ip->flags & I_BUSY)
+      panic("iput busy");
+    ip->flags |= I_BUSY;
+    release(&icache.lock);
+    iupdate(ip);
+    acquire(&icache.lock);
+    ip->flags &= ~I_BUSY;
+    wakeup(ip);
   }
   ip->ref--;
   release(&icache.lock);
@@ -312,38 +774,124 @@ iunlockput(struct inode *ip)
 // The contents (data) associated with each inode is stored
 // in a sequence of blocks on the disk.  The first NDIRECT blocks
 // are listed in ip->addrs[].  The next NINDIRECT blocks are 
-// listed in the block ip->addrs[NDIRECT].
+// listed in the block ip->addrs[NDIRECT].  A file system with
+// bigger blocks has more of them in the indirect block.
+
+// Where to put a new block of ip that follows block prev
+// (0 if unknown): right after prev, or else at the start of
+// the data blocks of ip's group.
+static uint
+bgoal(struct inode *ip, uint prev)
+{
+  struct superblock *sb;
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+  if(prev && prev != CMARK)
+    return prev + 1;
+  sb = getsb(ip->dev);
+  return GDATA(IGROUP(ip->inum, sb), sb);
+}
+
+// Return the disk block address of the nth block in inode ip,
+// or 0 if the block is a hole that has never been written.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr;
   struct buf *bp;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
-  }
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
   bn -= NDIRECT;
+  if(bn >= NINDIRECT(getsb(ip->dev)))
+    panic("bmap: out of range");
+  if(ip->addrs[NDIRECT] == 0)
+    return 0;
+  bp = bread(ip->dev, ip->addrs[NDIRECT], ip->inum);
+  addr = ((uint*)bp->data)[bn];
+  brelse(bp);
+  return addr;
+}
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr, ip->inum);
+// Give ip its own copy of its shared indirect block.
+// The blocks listed in it gain an owner, the copy.
+static void
+iunshare(struct inode *ip)
+{
+  uint old, addr, n;
+  struct buf *bp, *op;
+
+  old = ip->addrs[NDIRECT];
+  n = NINDIRECT(getsb(ip->dev));
+  addr = balloc(ip->dev, bgoal(ip, ip->addrs[NDIRECT-1]));
+  bp = bnew(ip->dev, addr, ip->inum);
+  op = bread(ip->dev, old, ip->inum);
+  memmove(bp->data, op->data, bp->bsize);
+  brelse(op);
+  brefadd(ip->dev, (uint*)bp->data, n, 1);
+  bwrite(bp);
+  brelse(bp);
+  ip->addrs[NDIRECT] = addr;
+  idirty(ip);
+
+  if(!bunref(ip->dev, old)){
+    // The other owners dropped old meanwhile, leaving ip
+    // the last: the blocks of old lose the owner it was.
+    op = bread(ip->dev, old, ip->inum);
+    brefadd(ip->dev, (uint*)op->data, n, -1);
+    brelse(op);
+    bdrop(ip->dev, old);
+  }
+}
+
+// Like bmap, but make sure ip has an nth block of its own that
+// it can write, allocating one if there is none or if the block
+// is shared.  A new block holds stale data: *fresh is set and
+// the caller must fill the whole block, with zeroes (bnew gives
+// a zeroed buffer) or, if *old is non-zero, with the contents of
+// the shared block old, and then drop ip's ownership of old.
+static uint
+bmapalloc(struct inode *ip, uint bn, int *fresh, uint *old)
+{
+  uint addr, *a, prev;
+  struct buf *bp;
+
+  *fresh = 0;
+  *old = 0;
+  if(bn < NDIRECT){
+    if((addr = ip->addrs[bn]) != 0 && !bshared(ip->dev, addr))
+      return addr;
+    *old = addr;
+    prev = bn ? ip->addrs[bn-1] : 0;
+    ip->addrs[bn] = addr = balloc(ip->dev, bgoal(ip, prev));
+    idirty(ip);
+  } else {
+    bn -= NDIRECT;
+    if(bn >= NINDIRECT(getsb(ip->dev)))
+      panic("bmapalloc: out of range");
+
+    // Load indirect block, allocating or copying if necessary.
+    if((addr = ip->addrs[NDIRECT]) == 0){
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, bgoal(ip, ip->addrs[NDIRECT-1]));
+      idirty(ip);
+      bp = bnew(ip->dev, addr, ip->inum);
+    } else {
+      if(bshared(ip->dev, addr))
+        iunshare(ip);
+      bp = bread(ip->dev, ip->addrs[NDIRECT], ip->inum);
+    }
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      bwrite(bp);
+    if((addr = a[bn]) != 0 && !bshared(ip->dev, addr)){
+      brelse(bp);
+      return addr;
     }
+    *old = addr;
+    prev = bn ? a[bn-1] : ip->addrs[NDIRECT];
+    a[bn] = addr = balloc(ip->dev, bgoal(ip, prev));
+    bwrite(bp);
     brelse(bp);
-    return addr;
   }
-
-  panic("bmap: out of range");
+  *fresh = 1;
+  return addr;
 }
 
 // Truncate inode (discard contents).
@@ -354,31 +902,464 @@ itrunc(struct inode *ip)
 {
   int i, j;
   struct buf *bp;
+  struct bfreebatch fb;
   uint *a;
 
+  pcacheinval(ip);
+  fb.dev = ip->dev;
+  fb.bp = 0;
   for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+    if(ip->addrs[i] && ip->addrs[i] != CMARK && !bunref(ip->dev, ip->addrs[i]))
+      bfreeadd(&fb, ip->addrs[i]);
+    ip->addrs[i] = 0;
   }
   
-  if(ip->addrs[NDIRECT]){
+  // A shared indirect block keeps its blocks for its other owners.
+  if(ip->addrs[NDIRECT] && !bunref(ip->dev, ip->addrs[NDIRECT])){
     bp = bread(ip->dev, ip->addrs[NDIRECT], ip->inum);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    for(j = 0; j < NINDIRECT(getsb(ip->dev)); j++){
+      if(a[j] && a[j] != CMARK && !bunref(ip->dev, a[j]))
+        bfreeadd(&fb, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfreeadd(&fb, ip->addrs[NDIRECT]);
   }
+  ip->addrs[NDIRECT] = 0;
+  bfreeflush(&fb);
 
   ip->size = 0;
+  ip->attr = 0;
+  iupdate(ip);
+}
+
+// Copy the contents of block from to block to.
+static void
+bmove(struct inode *ip, uint from, uint to)
+{
+  struct buf *fp, *tp;
+
+  fp = bread(ip->dev, from, ip->inum);
+  tp = bnew(ip->dev, to, ip->inum);
+  memmove(tp->data, fp->data, fp->bsize);
+  brelse(fp);
+  bwrite(tp);
+  brelse(tp);
+}
+
+// Count ip's blocks, its indirect block included, and the
+// runs of consecutive blocks (extents) they are stored in,
+// taken in the order that idefrag lays them out.
+// Returns the number of extents, or -1 if a block is shared.
+static int
+iextents(struct inode *ip, uint *nblocks)
+{
+  uint i, n, prev, *a;
+  int ext;
+  struct buf *bp;
+
+  n = 0;
+  ext = 0;
+  prev = 0;
+  for(i = 0; i <= NDIRECT; i++){
+    if(ip->addrs[i] == 0 || ip->addrs[i] == CMARK)
+      continue;
+    if(bshared(ip->dev, ip->addrs[i]))
+      return -1;
+    if(ip->addrs[i] != prev + 1)
+      ext++;
+    prev = ip->addrs[i];
+    n++;
+  }
+  if(ip->addrs[NDIRECT]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT], ip->inum);
+    a = (uint*)bp->data;
+    for(i = 0; i < NINDIRECT(getsb(ip->dev)); i++){
+      if(a[i] == 0 || a[i] == CMARK)
+        continue;
+      if(bshared(ip->dev, a[i])){
+        brelse(bp);
+        return -1;
+      }
+      if(a[i] != prev + 1)
+        ext++;
+      prev = a[i];
+      n++;
+    }
+    brelse(bp);
+  }
+  *nblocks = n;
+  return ext;
+}
+
+// Return the number of extents of locked file ip, after moving
+// its blocks into one extent first if move is set: the direct
+// blocks, then the indirect block, then the blocks it lists.
+// Readers wait on the inode lock, so they see either the old
+// blocks or the new ones.  Files with shared blocks and
+// compressed files are not moved.  Returns -1 on failure.
+int
+idefrag(struct inode *ip, int move)
+{
+  uint i, n, next, old[NDIRECT+1], *a, *na;
+  int ext;
+  struct buf *bp, *np;
+  struct bfreebatch fb;
+
+  if(ip->type != T_FILE || (ext = iextents(ip, &n)) < 0)
+    return -1;
+  if(!move || ext <= 1)
+    return ext;
+  if(ip->attr & A_COMPRESS)
+    return -1;
+  next = ballocrun(ip->dev, IGROUP(ip->inum, getsb(ip->dev)), n);
+  if(next == 0)
+    return -1;
+
+  // Copy everything to the new run, then switch the inode
+  // over to it, then free the old blocks.
+  memmove(old, ip->addrs, sizeof(old));
+  for(i = 0; i < NDIRECT; i++){
+    if(ip->addrs[i]){
+      bmove(ip, ip->addrs[i], next);
+      ip->addrs[i] = next++;
+    }
+  }
+  if(ip->addrs[NDIRECT]){
+    bp = bread(ip->dev, old[NDIRECT], ip->inum);
+    np = bnew(ip->dev, next, ip->inum);
+    ip->addrs[NDIRECT] = next++;
+    a = (uint*)bp->data;
+    na = (uint*)np->data;
+    for(i = 0; i < NINDIRECT(getsb(ip->dev)); i++){
+      if(a[i]){
+        bmove(ip, a[i], next);
+        na[i] = next++;
+      }
+    }
+    bwrite(np);
+    brelse(np);
+    brelse(bp);
+  }
+  iupdate(ip);
+
+  fb.dev = ip->dev;
+  fb.bp = 0;
+  for(i = 0; i < NDIRECT; i++)
+    if(old[i])
+      bfreeadd(&fb, old[i]);
+  if(old[NDIRECT]){
+    bp = bread(ip->dev, old[NDIRECT], ip->inum);
+    a = (uint*)bp->data;
+    for(i = 0; i < NINDIRECT(getsb(ip->dev)); i++)
+      if(a[i])
+        bfreeadd(&fb, a[i]);
+    brelse(bp);
+    bfreeadd(&fb, old[NDIRECT]);
+  }
+  bfreeflush(&fb);
+  return 1;
+}
+
+// Make dst, an empty file, a copy of file src that shares
+// its blocks until one of them writes to them.  Only the
+// direct blocks and the indirect block gain an owner, so the
+// time taken does not depend on the size of src.
+// Both inodes must be locked.
+int
+iclone(struct inode *dst, struct inode *src)
+{
+  if(src->type != T_FILE || dst->type != T_FILE ||
+     dst->dev != src->dev || dst->size != 0 || (src->attr & A_COMPRESS))
+    return -1;
+  brefadd(src->dev, src->addrs, NDIRECT+1, 1);
+  memmove(dst->addrs, src->addrs, sizeof(src->addrs));
+  dst->size = src->size;
+  iupdate(dst);
+  return 0;
+}
+
+// Compressed clusters (see fs.h).  Reads decompress a whole
+// cluster into the page cache; a write to a compressed cluster
+// first stores it uncompressed again.
+
+// Exchange the block map entries bn..bn+n-1 of ip, which has
+// no shared blocks, with addrs[0..n-1].
+static void
+bmapswap(struct inode *ip, uint bn, uint *addrs, uint n)
+{
+  uint i, t, *a;
+  struct buf *bp;
+
+  bp = 0;
+  for(i = 0; i < n; i++, bn++){
+    if(bn < NDIRECT){
+      t = ip->addrs[bn];
+      ip->addrs[bn] = addrs[i];
+      addrs[i] = t;
+      continue;
+    }
+    if(bp == 0){
+      if(ip->addrs[NDIRECT] == 0){
+        ip->addrs[NDIRECT] = balloc(ip->dev, bgoal(ip, ip->addrs[NDIRECT-1]));
+        bp = bnew(ip->dev, ip->addrs[NDIRECT], ip->inum);
+      } else
+        bp = bread(ip->dev, ip->addrs[NDIRECT], ip->inum);
+    }
+    a = (uint*)bp->data;
+    t = a[bn - NDIRECT];
+    a[bn - NDIRECT] = addrs[i];
+    addrs[i] = t;
+  }
+  if(bp){
+    bwrite(bp);
+    brelse(bp);
+  }
   iupdate(ip);
 }
 
+// Is cluster c of ip compressed?
+static int
+ccompressed(struct inode *ip, uint c)
+{
+  struct superblock *sb;
+  uint k;
+
+  if(!(ip->attr & A_COMPRESS))
+    return 0;
+  sb = getsb(ip->dev);
+  k = CLUSTER(sb);
+  if(k < 2 || (c+1)*k > MAXFILE(sb))
+    return 0;
+  return bmap(ip, (c+1)*k - 1) == CMARK;
+}
+
+// Decompress compressed cluster c of ip into page.
+// Returns -1 if out of memory or the data is corrupt.
+static int
+cread(struct inode *ip, uint c, char *page)
+{
+  uint j, k, n, bs, addr;
+  int r;
+  char *z;
+  struct buf *bp;
+
+  if((z = kalloc()) == 0)
+    return -1;
+  bs = getsb(ip->dev)->bsize;
+  k = CLUSTER(getsb(ip->dev));
+  n = 0;
+  for(j = 0; j < k && (addr = bmap(ip, c*k + j)) != CMARK; j++){
+    bp = bread(ip->dev, addr, ip->inum);
+    memmove(z + n, bp->data, bs);
+    brelse(bp);
+    n += bs;
+  }
+  memset(page, 0, CLUSTERSIZE);
+  r = -1;
+  if(n > sizeof(uint) && *(uint*)z <= n - sizeof(uint))
+    r = lzdecompress(z + sizeof(uint), *(uint*)z, page, CLUSTERSIZE);
+  kfree(z);
+  return r < 0 ? -1 : 0;
+}
+
+// Store compressed cluster c of ip uncompressed again.
+static int
+cexpand(struct inode *ip, uint c)
+{
+  uint j, k, bs, addrs[CLUSTERSIZE/SECTSIZE];
+  char *page;
+  struct buf *bp;
+  struct bfreebatch fb;
+
+  if((page = kalloc()) == 0)
+    return -1;
+  if(cread(ip, c, page) < 0){
+    kfree(page);
+    return -1;
+  }
+  bs = getsb(ip->dev)->bsize;
+  k = CLUSTER(getsb(ip->dev));
+  for(j = 0; j < k; j++){
+    addrs[j] = 0;
+    if(c*CLUSTERSIZE + j*bs >= ip->size)
+      continue;  // past the end: leave a hole
+    addrs[j] = balloc(ip->dev, bgoal(ip, j ? addrs[j-1] : 0));
+    bp = bnew(ip->dev, addrs[j], ip->inum);
+    memmove(bp->data, page + j*bs, bs);
+    bwrite(bp);
+    brelse(bp);
+  }
+  bmapswap(ip, c*k, addrs, k);
+  fb.dev = ip->dev;
+  fb.bp = 0;
+  for(j = 0; j < k; j++)
+    if(addrs[j] != CMARK)
+      bfreeadd(&fb, addrs[j]);
+  bfreeflush(&fb);
+  kfree(page);
+  return 0;
+}
+
+// Fill page with page pgno of locked inode ip, for the page cache.
+// Returns -1 if a compressed cluster cannot be read.
+int
+ireadpage(struct inode *ip, uint pgno, char *page)
+{
+  if(ccompressed(ip, pgno))
+    return cread(ip, pgno, page);
+  memset(page, 0, PGSIZE);
+  if(pgno*PGSIZE < ip->size)
+    readi(ip, page, pgno*PGSIZE, min(PGSIZE, ip->size - pgno*PGSIZE));
+  return 0;
+}
+
+// Compress each cluster of locked file ip that shrinks by at
+// least one block, and mark ip A_COMPRESS.  Files with shared
+// blocks cannot be compressed.  Returns the number of blocks
+// freed, or -1.
+int
+icompress(struct inode *ip)
+{
+  struct superblock *sb;
+  uint c, j, k, n, m, bs, len, addrs[CLUSTERSIZE/SECTSIZE];
+  int clen, freed;
+  char *page, *z;
+  ushort *tab;
+  struct buf *bp;
+  struct bfreebatch fb;
+
+  sb = getsb(ip->dev);
+  bs = sb->bsize;
+  k = CLUSTER(sb);
+  if(ip->type != T_FILE || k < 2 || iextents(ip, &n) < 0)
+    return -1;
+  page = kalloc();
+  z = kalloc();
+  tab = (ushort*)kalloc();
+  if(page == 0 || z == 0 || tab == 0){
+    freed = -1;
+    goto out;
+  }
+
+  ip->attr |= A_COMPRESS;
+  freed = 0;
+  for(c = 0; (c+1)*k <= MAXFILE(sb) && c*CLUSTERSIZE < ip->size; c++){
+    if(ccompressed(ip, c))
+      continue;
+    n = 0;
+    for(j = 0; j < k; j++)
+      if(bmap(ip, c*k + j))
+        n++;
+    if(n < 2)
+      continue;
+    len = min(CLUSTERSIZE, ip->size - c*CLUSTERSIZE);
+    if(readi(ip, page, c*CLUSTERSIZE, len) != len)
+      continue;
+    clen = lzcompress(page, len, z + sizeof(uint), (n-1)*bs - sizeof(uint), tab);
+    if(clen < 0)
+      continue;
+    *(uint*)z = clen;
+    m = (sizeof(uint) + clen + bs - 1) / bs;
+    for(j = 0; j < k; j++){
+      if(j >= m){
+        addrs[j] = CMARK;
+        continue;
+      }
+      addrs[j] = balloc(ip->dev, bgoal(ip, j ? addrs[j-1] : 0));
+      bp = bnew(ip->dev, addrs[j], ip->inum);
+      memmove(bp->data, z + j*bs, bs);
+      bwrite(bp);
+      brelse(bp);
+    }
+    bmapswap(ip, c*k, addrs, k);
+    fb.dev = ip->dev;
+    fb.bp = 0;
+    for(j = 0; j < k; j++)
+      if(addrs[j])
+        bfreeadd(&fb, addrs[j]);
+    bfreeflush(&fb);
+    freed += n - m;
+  }
+  iupdate(ip);
+
+out:
+  if(page)
+    kfree(page);
+  if(z)
+    kfree(z);
+  if(tab)
+    kfree((char*)tab);
+  return freed;
+}
+
+// Prefetch, or let the cache reuse first, blocks bn..end-1 of ip.
+static void
+iadviseblocks(struct inode *ip, uint bn, uint end, int prefetch)
+{
+  uint addr, last;
+
+  last = (ip->size + getsb(ip->dev)->bsize - 1) / getsb(ip->dev)->bsize;
+  if(end > last)
+    end = last;
+  for(; bn < end; bn++){
+    if((addr = bmap(ip, bn)) == 0 || addr == CMARK)
+      continue;
+    if(prefetch)
+      bprefetch(ip->dev, addr, ip->inum);
+    else
+      bforget(ip->dev, addr);
+  }
+}
+
+// Act on access hint advice (FADV_*) for n bytes of ip at off.
+// WILLNEED starts reading their blocks; DONTNEED and NOREUSE
+// let the buffers holding them be reused first.  SEQUENTIAL,
+// given the bytes just read, does the same as NOREUSE for them
+// and starts reading the NREADAHEAD blocks after them: the
+// blocks behind a sequential reader must go first, or read-ahead
+// would evict the blocks it has read but the reader has not.
+// Caller holds ip's lock, perhaps shared.
+void
+iadvise(struct inode *ip, uint off, uint n, int advice)
+{
+  uint bs, bn, end;
+
+  if(ip->type != T_FILE || off >= ip->size)
+    return;
+  if(n > ip->size - off)
+    n = ip->size - off;
+  if(n == 0)
+    return;
+  bs = getsb(ip->dev)->bsize;
+  bn = off / bs;
+  end = (off + n - 1) / bs + 1;
+  switch(advice){
+  case FADV_WILLNEED:
+    iadviseblocks(ip, bn, end, 1);
+    break;
+  case FADV_SEQUENTIAL:
+    // Keep a partly read last block for the next read.
+    iadviseblocks(ip, bn, (off + n) % bs ? end - 1 : end, 0);
+    iadviseblocks(ip, end, end + NREADAHEAD, 1);
+    break;
+  case FADV_DONTNEED:
+  case FADV_NOREUSE:
+    iadviseblocks(ip, bn, end, 0);
+    break;
+  }
+}
+
+// Largest size of a file on ip's file system.
+uint
+imaxsize(struct inode *ip)
+{
+  struct superblock *sb;
+
+  sb = getsb(ip->dev);
+  return MAXFILE(sb)*sb->bsize;
+}
+
 // Copy stat information from inode.
 void
 stati(struct inode *ip, struct stat *st)
@@ -390,12 +1371,37 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reading the inode blocks of the entries in block bp
+// of directory dp.  A program listing the directory will stat
+// each entry next, and would otherwise wait for each inode
+// block in turn.
+static void
+dirprefetch(struct inode *dp, struct buf *bp)
+{
+  struct superblock *sb;
+  struct dirent *de;
+  uint bno, last;
+
+  sb = getsb(dp->dev);
+  last = IBLOCK(dp->inum, sb);
+  for(de = (struct dirent*)bp->data;
+      de < (struct dirent*)(bp->data + sb->bsize);
+      de++){
+    if(de->inum == 0 || de->inum >= sb->ninodes)
+      continue;
+    if((bno = IBLOCK(de->inum, sb)) != last)
+      bprefetch(dp->dev, bno, de->inum);
+    last = bno;
+  }
+}
+
 // Read data from inode.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr, bs;
   struct buf *bp;
+  char *page;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -408,21 +1414,88 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  bs = getsb(ip->dev)->bsize;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE), ip->inum);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
+    // Copy straight from the page cache if the page is there.
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(pcacheread(ip, dst, off, m) == m)
+      continue;
+    if(ccompressed(ip, off/PGSIZE)){
+      if((page = pcacheget(ip, off/PGSIZE)) == 0)
+        return -1;
+      memmove(dst, page + off%PGSIZE, m);
+      pcacheput(page);
+      continue;
+    }
+    m = min(n - tot, bs - off%bs);
+    if((addr = bmap(ip, off/bs)) == 0){
+      memmove(dst, zeroblock, m);  // a hole reads as zeroes
+      continue;
+    }
+    bp = bread(ip->dev, addr, ip->inum);
+    if(ip->type == T_DIR && off%bs == 0)
+      dirprefetch(ip, bp);
+    memmove(dst, bp->data + off%bs, m);
     brelse(bp);
   }
   return n;
 }
 
+// Pass n bytes of ip starting at off to sink, one piece per
+// block, straight out of the buffer cache.  Stops early if sink
+// takes less than it was given.  Returns the number of bytes
+// sink accepted, or -1 if nothing could be sent.
+// sink runs holding a cache buffer, so it must not wait for
+// another process.
+int
+sendi(struct inode *ip, uint off, uint n, int (*sink)(void*, char*, uint), void *arg)
+{
+  uint tot, m, addr, bs;
+  int r;
+  struct buf *bp;
+  char *page;
+
+  if(ip->type == T_DEV)
+    return -1;
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  bs = getsb(ip->dev)->bsize;
+  for(tot=0; tot<n; tot+=m, off+=m){
+    m = min(n - tot, bs - off%bs);
+    if(ccompressed(ip, off/PGSIZE)){
+      if((page = pcacheget(ip, off/PGSIZE)) == 0)
+        return tot ? tot : -1;
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = sink(arg, page + off%PGSIZE, m);
+      pcacheput(page);
+    } else if((addr = bmap(ip, off/bs)) == 0)
+      r = sink(arg, zeroblock, m);
+    else {
+      bp = bread(ip->dev, addr, ip->inum);
+      r = sink(arg, (char*)bp->data + off%bs, m);
+      brelse(bp);
+    }
+    if(r != m){
+      if(r > 0)
+        tot += r;
+      else if(tot == 0)
+        return -1;
+      break;
+    }
+  }
+  return tot;
+}
+
 // Write data to inode.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, addr, bs, max, old;
+  int fresh;
+  struct buf *bp, *op;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -430,22 +1503,47 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return devsw[ip->major].write(ip, src, n);
   }
 
-  if(off > ip->size || off + n < off)
+  // Writing past the end of the file leaves a hole,
+  // which takes no disk blocks until it is written.
+  bs = getsb(ip->dev)->bsize;
+  max = imaxsize(ip);
+  if(off > max || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
-    n = MAXFILE*BSIZE - off;
+  if(off + n > max)
+    n = max - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE), ip->inum);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
+    if(ccompressed(ip, off/CLUSTERSIZE) && cexpand(ip, off/CLUSTERSIZE) < 0){
+      n = tot;
+      break;
+    }
+    // A new block needs no disk read: zero it in memory,
+    // and this write puts the zeroes on disk with the data.
+    // A copy of a shared block needs the old contents only
+    // if this write does not cover the whole block.
+    addr = bmapalloc(ip, off/bs, &fresh, &old);
+    m = min(n - tot, bs - off%bs);
+    if(fresh)
+      bp = bnew(ip->dev, addr, ip->inum);
+    else
+      bp = bread(ip->dev, addr, ip->inum);
+    if(old){
+      if(m < bs){
+        op = bread(ip->dev, old, ip->inum);
+        memmove(bp->data, op->data, bs);
+        brelse(op);
+      }
+      bdrop(ip->dev, old);
+    }
+    memmove(bp->data + off%bs, src, m);
+    pcachewrite(ip, src, off, m);
     bwrite(bp);
     brelse(bp);
   }
 
   if(n > 0 && off > ip->size){
     ip->size = off;
-    iupdate(ip);
+    idirty(ip);
   }
   return n;
 }
@@ -464,17 +1562,18 @@ namecmp(const char *s, const char *t)
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, bs;
   struct buf *bp;
   struct dirent *de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += BSIZE){
-    bp = bread(dp->dev, bmap(dp, off / BSIZE), dp->inum);
+  bs = getsb(dp->dev)->bsize;
+  for(off = 0; off < dp->size; off += bs){
+    bp = bread(dp->dev, bmap(dp, off / bs), dp->inum);
     for(de = (struct dirent*)bp->data;
-        de < (struct dirent*)(bp->data + BSIZE);
+        de < (struct dirent*)(bp->data + bs);
         de++){
       if(de->inum == 0)
         continue;
@@ -492,28 +1591,66 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   return 0;
 }
 
+// Look up names[0..n-1] in directory dp in a single pass.
+// Sets ips[i] to the inode of each name, or 0 if it is not
+// present, and offs[i] to the byte offset of its entry.
+// Returns the offset of the first empty entry, or dp->size
+// if there is none.
+uint
+dirscan(struct inode *dp, char **names, struct inode **ips, uint *offs, int n)
+{
+  uint off, doff, bs, empty;
+  int i;
+  struct buf *bp;
+  struct dirent *de;
+
+  if(dp->type != T_DIR)
+    panic("dirscan not DIR");
+
+  for(i = 0; i < n; i++)
+    ips[i] = 0;
+  empty = dp->size;
+  bs = getsb(dp->dev)->bsize;
+  for(off = 0; off < dp->size; off += bs){
+    bp = bread(dp->dev, bmap(dp, off / bs), dp->inum);
+    for(de = (struct dirent*)bp->data;
+        de < (struct dirent*)(bp->data + bs);
+        de++){
+      doff = off + (uchar*)de - bp->data;
+      if(doff >= dp->size)
+        break;
+      if(de->inum == 0){
+        if(empty == dp->size)
+          empty = doff;
+        continue;
+      }
+      for(i = 0; i < n; i++){
+        if(ips[i] == 0 && namecmp(names[i], de->name) == 0){
+          ips[i] = iget(dp->dev, de->inum);
+          offs[i] = doff;
+        }
+      }
+    }
+    brelse(bp);
+  }
+  return empty;
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off, xoff;
   struct dirent de;
   struct inode *ip;
 
-  // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
+  // Check that name is not present, and find an empty dirent.
+  off = dirscan(dp, &name, &ip, &xoff, 1);
+  if(ip != 0){
     iput(ip);
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
-  }
-
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
@@ -1,27 +1,40 @@
 // On-disk file system format. 
 // Both the kernel and user programs use this header file.
 
-// Block 0 is unused.
-// Block 1 is super block.
-// Inodes start at block 2.
+// Each file system has its own block size, a power of two from
+// SECTSIZE to MAXBSIZE bytes, recorded in the super block.
+// Sector 0 is unused.
+// Sector 1 is the super block, so that it can be found before
+// the block size is known.
+// The rest of the disk, from block FSTART on, is divided into block
+// groups of bpg blocks.  Each group holds its own inodes, then
+// one bitmap block for the blocks of the group, then one block
+// of reference counts for them, then data blocks, so that a
+// file's data can be kept close to its inode.
 
-#define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define ROOTINO 1     // root i-number
+#define SECTSIZE 512  // disk sector size
+#define SBSECT 1      // sector holding the super block
 
 // File system super block
 struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
+  uint ngroups;      // Number of block groups
+  uint bpg;          // Blocks per group (at most BPB and bsize/2)
+  uint ipg;          // Inodes per group (multiple of IPB)
+  uint bsize;        // Block size (bytes)
 };
 
 #define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NINDIRECT(sb) ((sb)->bsize / sizeof(uint))
+#define MAXFILE(sb) (NDIRECT + NINDIRECT(sb))
 
 // On-disk inode structure
 struct dinode {
-  short type;           // File type
+  uchar type;           // File type
+  uchar attr;           // File attributes (A_*)
   short major;          // Major device number (T_DEV only)
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
@@ -29,17 +42,47 @@ struct dinode {
   uint addrs[NDIRECT+1];   // Data block addresses
 };
 
+// File attributes
+#define A_COMPRESS 0x1  // file may hold compressed clusters
+
+// A compressed file is stored in clusters of one page of data:
+// CLUSTER(sb) consecutive blocks starting at a multiple of
+// CLUSTER(sb).  A compressed cluster holds a uint, the length
+// of the compressed data, and then the data itself, in the
+// blocks listed by the first block map entries of the cluster;
+// the other entries, always including the last, are CMARK.
+#define CLUSTERSIZE     4096
+#define CLUSTER(sb)     (CLUSTERSIZE / (sb)->bsize)
+#define CMARK           0xffffffff
+
 // Inodes per block.
-#define IPB           (BSIZE / sizeof(struct dinode))
+#define IPB(sb)         ((sb)->bsize / sizeof(struct dinode))
+
+// Bitmap bits per block
+#define BPB(sb)         ((sb)->bsize*8)
+
+// First block after the super block
+#define FSTART(sb)      (((SBSECT+1)*SECTSIZE + (sb)->bsize - 1) / (sb)->bsize)
+
+// First block of group g
+#define GSTART(g, sb)   (FSTART(sb) + (g)*(sb)->bpg)
+
+// Group holding inode i, and group holding block b
+#define IGROUP(i, sb)   ((i) / (sb)->ipg)
+#define BGROUP(b, sb)   (((b) - FSTART(sb)) / (sb)->bpg)
 
 // Block containing inode i
-#define IBLOCK(i)     ((i) / IPB + 2)
+#define IBLOCK(i, sb)   (GSTART(IGROUP(i, sb), sb) + (i) % (sb)->ipg / IPB(sb))
 
-// Bitmap bits per block
-#define BPB           (BSIZE*8)
+// Bitmap block of group g; bit k is for block GSTART(g, sb)+k
+#define BBLOCK(g, sb)   (GSTART(g, sb) + (sb)->ipg / IPB(sb))
+
+// Reference count block of group g: ushort k counts the
+// owners of block GSTART(g, sb)+k beyond the first
+#define RBLOCK(g, sb)   (BBLOCK(g, sb) + 1)
 
-// Block containing bit for block b
-#define BBLOCK(b, ninodes) (b/BPB + (ninodes)/IPB + 3)
+// First data block of group g
+#define GDATA(g, sb)    (RBLOCK(g, sb) + 1)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
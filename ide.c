@@ -1,4 +1,25 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.
+//
+// Disks 0 and 1 are the master and slave of the primary channel
+// (0x1f0, IRQ 14), disks 2 and 3 those of the secondary channel
+// (0x170, IRQ 15).  Each channel has its own lock and queue, so
+// the two channels run commands at the same time; the two disks
+// of a channel share them, as they share its registers.
+//
+// Data moves by bus master DMA if the IDE controller is a PCI
+// bus master (like QEMU's PIIX3), and otherwise by programmed
+// I/O (insl/outsl).  diskctl(dev, DISK_DMA, 0) switches a disk
+// to PIO, and a DMA error switches it for good.
+//
+// Bufs waiting for the disk are ordered by an I/O scheduler
+// (iosched.c), chosen with DISK_SCHED.  When the next one is
+// dispatched, the bufs the scheduler would send right after it
+// that hold the following blocks, all reads or all writes, go
+// along in a single command of up to DISK_MERGE sectors.
+//
+// With DISK_POLL set, iderw busy-waits for a while for its
+// request instead of sleeping until the interrupt, which for
+// a fast disk saves more time than the request takes.
 
 #include "types.h"
 #include "defs.h"
@@ -8,113 +29,500 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "disk.h"
+#include "iosched.h"
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
 #define IDE_DF        0x20
+#define IDE_DRQ       0x08
 #define IDE_ERR       0x01
 
+// Command block registers, from the channel's base port.
+#define IDE_DATA      0
+#define IDE_NSECT     2
+#define IDE_LBA0      3
+#define IDE_LBA1      4
+#define IDE_LBA2      5
+#define IDE_DRIVE     6
+#define IDE_STATUS    7  // read; write: IDE_COMMAND
+#define IDE_COMMAND   7
+
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+#define IDE_CMD_RDEXT    0x24  // LBA48 versions
+#define IDE_CMD_RDDMAEXT 0x25
+#define IDE_CMD_RDMULEXT 0x29
+#define IDE_CMD_WREXT    0x34
+#define IDE_CMD_WRDMAEXT 0x35
+#define IDE_CMD_WRMULEXT 0x39
+
+#define IDE_LBA28     (1<<28)  // sectors that LBA28 commands reach
+
+#define IDE_MAXSECT   256  // sectors per command (count 0 means 256)
+#define IDE_MULT      (MAXBSIZE/SECTSIZE)  // sectors per PIO interrupt
+
+#define NIDE          4    // disks, two per channel
+
+// Bus master IDE registers of a channel, at the I/O base in the
+// controller's BAR4 (primary) or 8 bytes after it (secondary).
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4     // physical address of the PRD table
+
+#define BM_START      0x01  // BM_CMD: run the transfer
+#define BM_TOMEM      0x08  // BM_CMD: transfer into memory (disk read)
+#define BM_ACTIVE     0x01  // BM_STATUS: transfer running
+#define BM_ERR        0x02  // BM_STATUS: transfer failed
+#define BM_INTR       0x04  // BM_STATUS: transfer done
+
+// Physical region descriptor: one piece of a DMA transfer,
+// which must not cross a 64KB boundary.
+struct prd {
+  uint addr;
+  ushort count;   // bytes
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor
+
+// A channel's queue points to the bufs now being read/written to
+// the disk, linked by qnext; its ioq holds the bufs waiting for
+// their turn.  You must hold the channel's lock while manipulating
+// either.
+struct channel {
+  struct spinlock lock;
+  ushort base;          // command block registers
+  ushort ctl;           // device control register
+  ushort bm;            // bus master registers, or 0 if no DMA
+  int irq;
+  struct buf *queue;
+  struct ioq ioq;
+  int dmabusy;          // queue was started with DMA
+  int polling;          // iderw calls polling for their bufs
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+  // The running command moves the ncmd bufs of queue.
+  // A PIO command moves its data IDE_MULT sectors at a time;
+  // pionext and piooff say where the next data goes or comes
+  // from, and pioleft how many bytes are still to move.
+  int ncmd;
+  struct buf *pionext;
+  uint piooff;
+  uint pioleft;
 
-static struct spinlock idelock;
-static struct buf *idequeue;
+  // A block of up to MAXBSIZE bytes crosses at most one 64KB
+  // boundary, so it needs at most two descriptors, and at most
+  // NBUF blocks are queued.  16-byte alignment keeps the table
+  // itself from crossing one.
+  struct prd prdt[2*NBUF] __attribute__((aligned(16)));
+};
 
-static int havedisk1;
-static void idestart(struct buf*);
+static struct channel chans[2] = {
+  { .base = 0x1f0, .ctl = 0x3f6, .irq = IRQ_IDE },
+  { .base = 0x170, .ctl = 0x376, .irq = IRQ_IDE2 },
+};
 
-// Wait for IDE disk to become ready.
+static int havedisk[NIDE];  // per disk: present
+static int usedma[NIDE];    // per disk: move data by DMA
+static int maxmerge[NIDE];  // per disk: sectors per command
+static int polltime[NIDE];  // per disk: status reads to poll for
+
+static void idestart(struct channel*, struct buf*);
+static void idesettle(struct channel*);
+static void idedmainit(void);
+
+// Wait for the selected IDE disk of c to become ready.
 static int
-idewait(int checkerr)
+idewait(struct channel *c, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY) 
+  while(((r = inb(c->base+IDE_STATUS)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY) 
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
+// Find the disks of c, and let IDE_MULT sectors, a file system
+// block of up to MAXBSIZE bytes, move per interrupt on each
+// (READ/WRITE MULTIPLE).
+static void
+idechaninit(struct channel *c, int d0)
+{
+  int i, d;
+
+  initlock(&c->lock, "ide");
+  ioqinit(&c->ioq, SCHED_DEADLINE);
+  if(inb(c->base+IDE_STATUS) == 0xff)
+    return;  // no channel: the bus floats
+  for(d = d0; d < d0+2; d++){
+    outb(c->base+IDE_DRIVE, 0xe0 | ((d&1)<<4));
+    if(inb(c->base+IDE_LBA1) == 0x14 && inb(c->base+IDE_LBA2) == 0xeb)
+      continue;  // ATAPI signature: a CD-ROM, not a disk
+    for(i=0; i<1000; i++){
+      if(inb(c->base+IDE_STATUS) != 0){
+        havedisk[d] = 1;
+        break;
+      }
+    }
+  }
+  outb(c->ctl, 2);  // no interrupt
+  for(d = d0+1; d >= d0; d--){
+    if(!havedisk[d])
+      continue;
+    outb(c->base+IDE_DRIVE, 0xe0 | ((d&1)<<4));
+    idewait(c, 0);
+    outb(c->base+IDE_NSECT, IDE_MULT);
+    outb(c->base+IDE_COMMAND, IDE_CMD_SETMUL);
+    idewait(c, 0);
+  }
+  if(havedisk[d0] || havedisk[d0+1]){
+    picenable(c->irq);
+    ioapicenable(c->irq, ncpu - 1);
+  }
+}
+
 void
 ideinit(void)
 {
+  int d;
+
+  for(d = 0; d < NIDE; d++)
+    maxmerge[d] = IDE_MAXSECT;
+  havedisk[0] = 1;  // the boot disk
+  idechaninit(&chans[0], 0);
+  idechaninit(&chans[1], 2);
+  idedmainit();
+  for(d = 0; d < NIDE; d++){
+    if(havedisk[d]){
+      bdevsw[d].rw = iderw;
+      bdevsw[d].prefetch = ideprefetch;
+      bdevsw[d].ctl = idectl;
+    }
+  }
+}
+
+// Find a bus master IDE controller (PCI class 1, subclass 1,
+// prog-if bit 7) and let it do DMA.
+static void
+idedmainit(void)
+{
+  struct pcidev d;
   int i;
 
-  initlock(&idelock, "ide");
-  picenable(IRQ_IDE);
-  ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
-  
-  // Check if disk 1 is present
-  outb(0x1f6, 0xe0 | (1<<4));
-  for(i=0; i<1000; i++){
-    if(inb(0x1f7) != 0){
-      havedisk1 = 1;
-      break;
+  if(pcifind(PCI_ANY, PCI_ANY, 0x01, 0x01, 0, &d) < 0 ||
+     !(d.progif & 0x80) || !(d.bar[4] & PCI_BAR_IO))
+    return;
+  pciwrite(&d, PCI_COMMAND, pciread(&d, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+  chans[0].bm = d.bar[4] & ~3;
+  chans[1].bm = chans[0].bm + 8;
+  for(i = 0; i < NIDE; i++)
+    usedma[i] = havedisk[i];
+}
+
+// Describe the data of the n bufs starting at b in c->prdt.
+static void
+prdinit(struct channel *c, struct buf *b, int n)
+{
+  struct prd *d;
+  uint pa, len, m;
+
+  d = c->prdt;
+  for(; n > 0; n--, b = b->qnext){
+    pa = PADDR(b->data);
+    for(len = b->bsize; len > 0; len -= m, pa += m){
+      m = 0x10000 - (pa & 0xffff);  // bytes up to the next 64KB boundary
+      if(m > len)
+        m = len;
+      d->addr = pa;
+      d->count = m;
+      d->flags = 0;
+      d++;
     }
   }
-  
-  // Switch back to disk 0.
-  outb(0x1f6, 0xe0 | (0<<4));
+  d[-1].flags = PRD_EOT;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Move the next IDE_MULT sectors (or fewer, at the end) of
+// a PIO command between the disk and the bufs.
 static void
-idestart(struct buf *b)
+piomove(struct channel *c, int out)
 {
+  uint n, m;
+  struct buf *b;
+
+  n = c->pioleft < IDE_MULT*SECTSIZE ? c->pioleft : IDE_MULT*SECTSIZE;
+  c->pioleft -= n;
+  for(; n > 0; n -= m){
+    b = c->pionext;
+    m = b->bsize - c->piooff;
+    if(m > n)
+      m = n;
+    if(out)
+      outsl(c->base+IDE_DATA, b->data + c->piooff, m/4);
+    else
+      insl(c->base+IDE_DATA, b->data + c->piooff, m/4);
+    c->piooff += m;
+    if(c->piooff == b->bsize){
+      c->pionext = b->qnext;
+      c->piooff = 0;
+    }
+  }
+}
+
+// Start the request for the ncmd bufs of c->queue, b first.
+// Caller must hold c->lock.
+// b->sector is a block number; a block is b->bsize/SECTSIZE
+// sectors.  Requests beyond the first IDE_LBA28 sectors use
+// the LBA48 commands.
+static void
+idestart(struct channel *c, struct buf *b)
+{
+  int nsect, n, w, ext;
+  uint sector;
+
   if(b == 0)
     panic("idestart");
+  nsect = b->bsize / SECTSIZE;
+  sector = b->sector * nsect;
+  if(nsect < 1 || nsect > MAXBSIZE/SECTSIZE)
+    panic("idestart: block size");
+  n = c->ncmd * nsect;
+  w = (b->flags & B_DIRTY) != 0;
+  ext = sector + n > IDE_LBA28;
 
-  idewait(0);
-  outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  outb(c->base+IDE_DRIVE, 0xe0 | ((b->dev&1)<<4) | (ext ? 0 : (sector>>24)&0x0f));
+  idewait(c, 0);
+  outb(c->ctl, c->polling ? 2 : 0);  // interrupt, unless polled
+  if(ext){
+    // The high bytes go first, through the same registers.
+    outb(c->base+IDE_NSECT, n >> 8);
+    outb(c->base+IDE_LBA0, (sector >> 24) & 0xff);
+    outb(c->base+IDE_LBA1, 0);  // sector is 32 bits
+    outb(c->base+IDE_LBA2, 0);
+  }
+  outb(c->base+IDE_NSECT, n & 0xff);  // number of sectors
+  outb(c->base+IDE_LBA0, sector & 0xff);
+  outb(c->base+IDE_LBA1, (sector >> 8) & 0xff);
+  outb(c->base+IDE_LBA2, (sector >> 16) & 0xff);
+  if((c->dmabusy = usedma[b->dev])){
+    prdinit(c, b, c->ncmd);
+    outb(c->bm+BM_CMD, 0);
+    outl(c->bm+BM_PRDT, PADDR(c->prdt));
+    outb(c->bm+BM_STATUS, BM_ERR|BM_INTR);  // clear
+    if(w){
+      outb(c->base+IDE_COMMAND, ext ? IDE_CMD_WRDMAEXT : IDE_CMD_WRDMA);
+      outb(c->bm+BM_CMD, BM_START);
+    } else {
+      outb(c->base+IDE_COMMAND, ext ? IDE_CMD_RDDMAEXT : IDE_CMD_RDDMA);
+      outb(c->bm+BM_CMD, BM_TOMEM|BM_START);
+    }
+    return;
+  }
+  c->pionext = b;
+  c->piooff = 0;
+  c->pioleft = n * SECTSIZE;
+  if(w){
+    if(ext)
+      outb(c->base+IDE_COMMAND, n == 1 ? IDE_CMD_WREXT : IDE_CMD_WRMULEXT);
+    else
+      outb(c->base+IDE_COMMAND, n == 1 ? IDE_CMD_WRITE : IDE_CMD_WRMUL);
+    piomove(c, 1);
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    if(ext)
+      outb(c->base+IDE_COMMAND, n == 1 ? IDE_CMD_RDEXT : IDE_CMD_RDMULEXT);
+    else
+      outb(c->base+IDE_COMMAND, n == 1 ? IDE_CMD_READ : IDE_CMD_RDMUL);
   }
+  idesettle(c);
 }
 
-// Interrupt handler.
-void
-ideintr(void)
+// Take the next bufs from c's scheduler, those it lets go in
+// one command, and start them.
+// Caller must hold c->lock, and the channel must be idle.
+static void
+idedispatch(struct channel *c)
 {
   struct buf *b;
 
-  // Take first buffer off queue.
-  acquire(&idelock);
-  if((b = idequeue) == 0){
-    release(&idelock);
-    cprintf("Spurious IDE interrupt.\n");
+  if((b = ioqnext(&c->ioq)) == 0)
     return;
+  c->queue = ioqtake(&c->ioq, maxmerge[b->dev], &c->ncmd);
+  idestart(c, c->queue);
+}
+
+// Finish a DMA transfer.  Returns -1 if it failed.
+static int
+idedmadone(struct channel *c)
+{
+  int s;
+
+  s = inb(c->bm+BM_STATUS);
+  outb(c->bm+BM_CMD, 0);
+  outb(c->bm+BM_STATUS, BM_ERR|BM_INTR);
+  if(idewait(c, 1) < 0 || (s & BM_ERR))
+    return -1;
+  return 0;
+}
+
+// The disk may take 400ns to show BSY after a command or
+// data: wait that long, reading the alternate status.
+static void
+idesettle(struct channel *c)
+{
+  int i;
+
+  for(i = 0; i < 4; i++)
+    inb(c->ctl);
+}
+
+// Does the command running on c need the driver: is it done,
+// or, for PIO, ready to move the next data?
+// Caller must hold c->lock.
+static int
+ideready(struct channel *c)
+{
+  int s;
+
+  if(c->queue == 0)
+    return 0;
+  if(c->dmabusy){
+    s = inb(c->bm+BM_STATUS);
+    return (s & BM_INTR) || !(s & BM_ACTIVE);
   }
-  idequeue = b->qnext;
+  s = inb(c->ctl);
+  if(s & IDE_BSY)
+    return 0;
+  if(s & (IDE_DF|IDE_ERR))
+    return 1;
+  if(!(c->queue->flags & B_DIRTY) || c->pioleft > 0)
+    return (s & IDE_DRQ) != 0;
+  return 1;
+}
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
-  
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+// Do what the command running on c needs, once ideready says
+// so, and start the next one when it is done.  Prefetched bufs
+// that are done go on *async for the caller to brelse after
+// releasing c->lock.
+static void
+ideserve(struct channel *c, struct buf **async)
+{
+  struct buf *b;
+
+  // The buffers in the queue are the ones moving.
+  b = c->queue;
+  if(c->dmabusy){
+    // On a DMA error, retry with PIO, and stay with PIO.
+    if(idedmadone(c) < 0){
+      cprintf("ide: disk %d: DMA failed, using PIO\n", b->dev);
+      usedma[b->dev] = 0;
+      idestart(c, b);
+      return;
+    }
+  } else if(idewait(c, 1) >= 0){
+    // A PIO command interrupts once per IDE_MULT sectors:
+    // read the data that is ready, or write the next piece.
+    // A write is done only at the interrupt after its last piece.
+    if(!(b->flags & B_DIRTY))
+      piomove(c, 0);
+    else if(c->pioleft > 0){
+      piomove(c, 1);
+      idesettle(c);
+      return;
+    }
+    if(c->pioleft > 0)
+      return;
+  } else
+    cprintf("ide: disk %d: error\n", b->dev);
+
+  // Wake processes waiting for these bufs.
+  while((b = c->queue) != 0){
+    c->queue = b->qnext;
+    diskdone(b);
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+    if(b->flags & B_ASYNC){
+      b->qnext = *async;
+      *async = b;
+    }
+  }
   
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  idedispatch(c);
+}
+
+// Release prefetched bufs that ideserve finished;
+// no process waits for them.
+static void
+idebrelse(struct buf *async)
+{
+  struct buf *b;
 
-  release(&idelock);
+  while((b = async) != 0){
+    async = b->qnext;
+    brelse(b);
+  }
+}
+
+// Interrupt handler for channel n.
+void
+ideintr(int n)
+{
+  struct channel *c;
+  struct buf *async;
+
+  c = &chans[n];
+  acquire(&c->lock);
+  async = 0;
+  // A polling iderw may have got there first.
+  if(ideready(c))
+    ideserve(c, &async);
+  release(&c->lock);
+  idebrelse(async);
+}
+
+// Has b been read or written?
+static int
+idedone(struct buf *b)
+{
+  return (b->flags & (B_VALID|B_DIRTY)) == B_VALID;
+}
+
+// Queue b, starting the channel if it is idle.
+// Caller must hold c->lock.
+static void
+ideappend(struct channel *c, struct buf *b)
+{
+  ioqadd(&c->ioq, b);
+  if(c->queue == 0)
+    idedispatch(c);
+}
+
+// Start reading b for bprefetch and return at once.
+// ideintr releases b when the read completes.
+void
+ideprefetch(struct buf *b)
+{
+  struct channel *c;
+
+  if((b->flags & (B_BUSY|B_ASYNC|B_VALID|B_DIRTY)) != (B_BUSY|B_ASYNC))
+    panic("ideprefetch");
+  if(b->dev >= NIDE || !havedisk[b->dev])
+    panic("ideprefetch: ide disk not present");
+
+  c = &chans[b->dev/2];
+  acquire(&c->lock);
+  ideappend(c, b);
+  release(&c->lock);
 }
 
 // Sync buf with disk. 
@@ -123,32 +531,92 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
+  struct channel *c;
+  struct buf *async;
+  uint64 t;
+  int i, polled;
 
   if(!(b->flags & B_BUSY))
     panic("iderw: buf not busy");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("idrw: ide disk 1 not present");
+  if(b->dev >= NIDE || !havedisk[b->dev])
+    panic("iderw: ide disk not present");
 
-  acquire(&idelock);
+  c = &chans[b->dev/2];
+  t = rdtsc();
+  acquire(&c->lock);
+  async = 0;
+  if(polltime[b->dev] > 0){
+    // Poll for a while, with the disk's interrupt off.
+    c->polling++;
+    ideappend(c, b);
+    for(i = 0; i < polltime[b->dev] && !idedone(b); i++)
+      if(ideready(c))
+        ideserve(c, &async);
+    if(--c->polling == 0 && c->queue){
+      outb(c->ctl, 0);  // interrupt again
+      if(ideready(c))   // but it may have missed the disk
+        ideserve(c, &async);
+    }
+  } else
+    ideappend(c, b);
+  polled = idedone(b);
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
-    ;
-  *pp = b;
-  
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
-  
   // Wait for request to finish.
   // Assuming will not sleep too long: ignore proc->killed.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID) {
-    sleep(b, &idelock);
-  }
+  while(!idedone(b))
+    sleep(b, &c->lock);
 
-  release(&idelock);
+  release(&c->lock);
+  idebrelse(async);
+  disksync(b->dev, polled, rdtsc() - t);
+}
+
+// Read, and unless val < 0 change, setting op (DISK_*) of disk dev.
+// DISK_SCHED applies to both disks of dev's channel.
+// Returns the old value, or -1.
+int
+idectl(int dev, int op, int val)
+{
+  struct channel *c;
+  int old;
+
+  if(dev < 0 || dev >= NIDE || !havedisk[dev])
+    return -1;
+  c = &chans[dev/2];
+  acquire(&c->lock);
+  switch(op){
+  case DISK_DMA:
+    old = usedma[dev];
+    if(val >= 0){
+      if(val && c->bm == 0){
+        old = -1;  // no bus master controller
+        break;
+      }
+      usedma[dev] = val != 0;
+    }
+    break;
+  case DISK_SCHED:
+    old = c->ioq.policy;
+    if(val >= 0 && ioqpolicy(&c->ioq, val) < 0)
+      old = -1;
+    break;
+  case DISK_MERGE:
+    old = maxmerge[dev];
+    if(val > IDE_MAXSECT)
+      old = -1;
+    else if(val >= 0)
+      maxmerge[dev] = val;
+    break;
+  case DISK_POLL:
+    old = polltime[dev];
+    if(val >= 0)
+      polltime[dev] = val;
+    break;
+  default:
+    old = -1;
+  }
+  release(&c->lock);
+  return old;
 }
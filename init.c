@@ -19,6 +19,15 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // update: write dirty inodes back every 30 seconds.
+  pid = fork();
+  if(pid == 0){
+    for(;;){
+      sleep(3000);
+      sync();
+    }
+  }
+
   for(;;){
     printf(1, "init: starting sh\n");
     pid = fork();
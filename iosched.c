@@ -0,0 +1,294 @@
+// I/O schedulers: the order in which queued bufs go to the disk.
+//
+// * FIFO serves bufs in arrival order.
+// * C-LOOK serves them in ascending sector order, sweeping up
+//     from the last sector served and then starting again from
+//     the lowest.  A heap keyed by (sweep, sector) holds them:
+//     a buf below the current position waits for the next sweep.
+// * Deadline serves bufs in C-LOOK order, unless the oldest read
+//     or write has waited longer than its expiry time.  It keeps
+//     the C-LOOK heap and a FIFO list for each direction.
+//
+// Adding and taking a buf costs O(1) for FIFO and O(log n) for
+// the others.  ioqtake takes along the bufs that follow the next
+// one on disk, so that a driver can move them with one command.
+// The caller must hold the driver's lock.
+//
+// ioqadd and ioqtake also stamp each buf with the times it was
+// queued and sent to the disk, for the disk statistics.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "fs.h"
+#include "buf.h"
+#include "iosched.h"
+#include "disk.h"
+
+#define READEXPIRE   5   // ticks a read may wait under deadline
+#define WRITEEXPIRE  50  // ticks a write may wait
+
+struct iosched {
+  void (*add)(struct ioq*, struct buf*);
+  struct buf* (*next)(struct ioq*);
+  void (*del)(struct ioq*, struct buf*);
+};
+
+static void
+qappend(struct bufq *l, struct buf *b)
+{
+  b->qnext = 0;
+  b->qprev = l->tail;
+  if(l->tail)
+    l->tail->qnext = b;
+  else
+    l->head = b;
+  l->tail = b;
+}
+
+static void
+qremove(struct bufq *l, struct buf *b)
+{
+  if(b->qprev)
+    b->qprev->qnext = b->qnext;
+  else
+    l->head = b->qnext;
+  if(b->qnext)
+    b->qnext->qprev = b->qprev;
+  else
+    l->tail = b->qprev;
+  b->qnext = b->qprev = 0;
+}
+
+// Does a go to the disk before b in C-LOOK order?
+static int
+heapless(struct buf *a, struct buf *b)
+{
+  if(a->qsweep != b->qsweep)
+    return (int)(a->qsweep - b->qsweep) < 0;
+  if(a->sector != b->sector)
+    return a->sector < b->sector;
+  return a->dev < b->dev;
+}
+
+static void
+heapset(struct ioq *q, int i, struct buf *b)
+{
+  q->heap[i] = b;
+  b->qheap = i;
+}
+
+// Move the buf at i up or down to its place in the heap.
+static void
+heapfix(struct ioq *q, int i)
+{
+  struct buf *b;
+  int c;
+
+  b = q->heap[i];
+  for(; i > 0 && heapless(b, q->heap[(i-1)/2]); i = (i-1)/2)
+    heapset(q, i, q->heap[(i-1)/2]);
+  for(; (c = 2*i+1) < q->nheap; i = c){
+    if(c+1 < q->nheap && heapless(q->heap[c+1], q->heap[c]))
+      c++;
+    if(!heapless(q->heap[c], b))
+      break;
+    heapset(q, i, q->heap[c]);
+  }
+  heapset(q, i, b);
+}
+
+static void
+heapadd(struct ioq *q, struct buf *b)
+{
+  if(q->nheap >= NBUF)
+    panic("heapadd");
+  b->qsweep = b->sector >= q->pos ? q->sweep : q->sweep + 1;
+  heapset(q, q->nheap++, b);
+  heapfix(q, b->qheap);
+}
+
+static void
+heapdel(struct ioq *q, struct buf *b)
+{
+  int i;
+
+  i = b->qheap;
+  if(i >= q->nheap || q->heap[i] != b)
+    panic("heapdel");
+  if(i != --q->nheap){
+    heapset(q, i, q->heap[q->nheap]);
+    heapfix(q, i);
+  }
+  // The sweep goes on from b.
+  q->sweep = b->qsweep;
+  q->pos = b->sector + 1;
+}
+
+static void
+fifoadd(struct ioq *q, struct buf *b)
+{
+  qappend(&q->fifo[0], b);
+}
+
+static struct buf*
+fifonext(struct ioq *q)
+{
+  return q->fifo[0].head;
+}
+
+static void
+fifodel(struct ioq *q, struct buf *b)
+{
+  qremove(&q->fifo[0], b);
+}
+
+static struct buf*
+clooknext(struct ioq *q)
+{
+  return q->nheap > 0 ? q->heap[0] : 0;
+}
+
+static void
+dladd(struct ioq *q, struct buf *b)
+{
+  int w;
+
+  w = (b->flags & B_DIRTY) != 0;
+  b->qdeadline = ticks + (w ? WRITEEXPIRE : READEXPIRE);
+  qappend(&q->fifo[w], b);
+  heapadd(q, b);
+}
+
+static struct buf*
+dlnext(struct ioq *q)
+{
+  struct buf *b;
+  int w;
+
+  for(w = 0; w < 2; w++){
+    b = q->fifo[w].head;
+    if(b && (int)(ticks - b->qdeadline) >= 0)
+      return b;
+  }
+  return clooknext(q);
+}
+
+static void
+dldel(struct ioq *q, struct buf *b)
+{
+  qremove(&q->fifo[(b->flags & B_DIRTY) != 0], b);
+  heapdel(q, b);
+}
+
+static struct iosched scheds[NSCHED] = {
+[SCHED_FIFO]     { fifoadd, fifonext, fifodel },
+[SCHED_CLOOK]    { heapadd, clooknext, heapdel },
+[SCHED_DEADLINE] { dladd, dlnext, dldel },
+};
+
+void
+ioqinit(struct ioq *q, int policy)
+{
+  memset(q, 0, sizeof(*q));
+  q->policy = policy;
+}
+
+static void
+ioqput(struct ioq *q, struct buf *b)
+{
+  scheds[q->policy].add(q, b);
+  q->n++;
+}
+
+// Queue b.
+void
+ioqadd(struct ioq *q, struct buf *b)
+{
+  b->tqueue = rdtsc();
+  diskqueued(b->dev, q->n);
+  ioqput(q, b);
+}
+
+// Return the buf that should go to the disk next, or 0 if none.
+// It stays queued until ioqdel.
+struct buf*
+ioqnext(struct ioq *q)
+{
+  if(q->n == 0)
+    return 0;
+  return scheds[q->policy].next(q);
+}
+
+// Take b off the queue.
+void
+ioqdel(struct ioq *q, struct buf *b)
+{
+  scheds[q->policy].del(q, b);
+  q->n--;
+}
+
+// Is b the block after a on the same disk, moving the same way?
+static int
+contig(struct buf *a, struct buf *b)
+{
+  return b->dev == a->dev && b->bsize == a->bsize &&
+    b->sector == a->sector + 1 &&
+    (b->flags & B_DIRTY) == (a->flags & B_DIRTY);
+}
+
+// Take the next buf off q, and after it the bufs q would serve
+// next while each holds the block after the one before, up to
+// max sectors in all (but at least the first buf).  Returns them
+// linked by qnext, and their number in *n; 0 if q is empty.
+struct buf*
+ioqtake(struct ioq *q, int max, int *n)
+{
+  struct buf *b, *p, *nb;
+  int nsect;
+  uint64 t;
+
+  if((b = ioqnext(q)) == 0)
+    return 0;
+  ioqdel(q, b);
+  t = rdtsc();
+  b->tstart = t;
+  nsect = b->bsize / SECTSIZE;
+  *n = 1;
+  for(p = b; (nb = ioqnext(q)) != 0 && contig(p, nb); p = nb){
+    if((*n+1) * nsect > max)
+      break;
+    ioqdel(q, nb);
+    nb->tstart = t;
+    p->qnext = nb;
+    (*n)++;
+  }
+  p->qnext = 0;
+  return b;
+}
+
+// Switch q to policy, requeueing the waiting bufs.
+// Returns the old policy, or -1 if policy is not valid.
+int
+ioqpolicy(struct ioq *q, int policy)
+{
+  struct bufq l;
+  struct buf *b;
+  int old;
+
+  if(policy < 0 || policy >= NSCHED)
+    return -1;
+  old = q->policy;
+  l.head = l.tail = 0;
+  while((b = ioqnext(q)) != 0){
+    ioqdel(q, b);
+    qappend(&l, b);
+  }
+  ioqinit(q, policy);
+  while((b = l.head) != 0){
+    qremove(&l, b);
+    ioqput(q, b);
+  }
+  return old;
+}
@@ -0,0 +1,18 @@
+// Disk request queues, ordered by an I/O scheduling policy
+// (SCHED_* in disk.h).  Used by disk drivers under their lock.
+
+// A list of bufs linked through qnext and qprev.
+struct bufq {
+  struct buf *head;
+  struct buf *tail;
+};
+
+struct ioq {
+  int policy;               // SCHED_*
+  int n;                    // bufs waiting
+  struct bufq fifo[2];      // FIFO: [0]; deadline: reads, writes
+  struct buf *heap[NBUF];   // C-LOOK order, for C-LOOK and deadline
+  int nheap;
+  uint sweep;               // C-LOOK sweep being served
+  uint pos;                 // sector after the last one taken
+};
@@ -0,0 +1,134 @@
+// iostat: report the activity of each disk, every interval
+// seconds (default 1), count times (default forever).  The
+// first report covers the time since boot, each later one the
+// interval before it.  Times are in cycles of the time stamp
+// counter, as the log2 bucket that the median time fell in.
+// With -h, also print the histograms of the times.
+// usage: iostat [-h] [interval [count]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "disk.h"
+
+int hist;
+struct diskstat last[NDISK];
+
+// Sum of the buckets of h that grew since h0.
+uint
+total(uint *h, uint *h0)
+{
+  uint n;
+  int i;
+
+  n = 0;
+  for(i = 0; i < NLAT; i++)
+    n += h[i] - h0[i];
+  return n;
+}
+
+// Print the median bucket of h since h0, or - if there is none.
+void
+median(char *what, uint *h, uint *h0)
+{
+  uint n, m;
+  int i;
+
+  printf(1, " %s ", what);
+  if((n = total(h, h0)) == 0){
+    printf(1, "-");
+    return;
+  }
+  m = 0;
+  for(i = 0; 2*m < n; i++)
+    m += h[i] - h0[i];
+  printf(1, "2^%d", i-1);
+}
+
+// Print the buckets of h that grew since h0.
+void
+printhist(char *what, uint *h, uint *h0)
+{
+  int i;
+
+  if(total(h, h0) == 0)
+    return;
+  printf(1, "    %s:", what);
+  for(i = 0; i < NLAT; i++)
+    if(h[i] != h0[i])
+      printf(1, " 2^%d:%d", i, h[i] - h0[i]);
+  printf(1, "\n");
+}
+
+// Report disk dev, whose statistics were st0 t ticks ago and are st now.
+void
+report(int dev, struct diskstat *st, struct diskstat *st0, int t)
+{
+  static char *dir[2] = { "read", "write" };
+  uint n, q;
+  int w;
+
+  printf(1, "disk %d: %d r/s, %d w/s, %d KB/s read, %d KB/s written",
+         dev, (st->nreq[0] - st0->nreq[0]) * 100 / t,
+         (st->nreq[1] - st0->nreq[1]) * 100 / t,
+         (st->nsect[0] - st0->nsect[0]) / 2 * 100 / t,
+         (st->nsect[1] - st0->nsect[1]) / 2 * 100 / t);
+  n = st->nqueued - st0->nqueued;
+  q = n ? (st->qsum - st0->qsum) * 10 / n : 0;
+  printf(1, ", queue %d.%d (most %d)\n", q / 10, q % 10, st->qmax);
+  printf(1, "  time:");
+  for(w = 0; w < 2; w++){
+    median(dir[w], st->lat[w], st0->lat[w]);
+    median("waiting", st->qlat[w], st0->qlat[w]);
+    median("on disk", st->svclat[w], st0->svclat[w]);
+    printf(1, w ? "\n" : ";");
+  }
+  if(!hist)
+    return;
+  for(w = 0; w < 2; w++){
+    printf(1, "  %ss:\n", dir[w]);
+    printhist("whole", st->lat[w], st0->lat[w]);
+    printhist("waiting", st->qlat[w], st0->qlat[w]);
+    printhist("on disk", st->svclat[w], st0->svclat[w]);
+  }
+  printhist("synchronous, interrupt", st->synclat[0], st0->synclat[0]);
+  printhist("synchronous, polled", st->synclat[1], st0->synclat[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static struct diskstat zero;
+  struct diskstat st;
+  int i, dev, interval, count, t, t0;
+
+  i = 1;
+  if(argc > i && strcmp(argv[i], "-h") == 0){
+    hist = 1;
+    i++;
+  }
+  interval = argc > i ? atoi(argv[i]) : 1;
+  count = argc > i+1 ? atoi(argv[i+1]) : -1;
+  if(interval < 1){
+    printf(2, "usage: iostat [-h] [interval [count]]\n");
+    exit();
+  }
+
+  t0 = 0;
+  for(i = 0; i != count; i++){
+    if(i > 0)
+      sleep(interval * 100);
+    if((t = uptime()) == t0)
+      t = t0 + 1;
+    for(dev = 0; dev < NDISK; dev++){
+      if(diskstat(dev, &st) < 0)
+        continue;
+      report(dev, &st, i ? &last[dev] : &zero, t - t0);
+      last[dev] = st;
+    }
+    t0 = t;
+    printf(1, "\n");
+  }
+  exit();
+}
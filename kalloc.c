@@ -1,20 +1,42 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Each CPU keeps a magazine of up to MAGSIZE free pages, which
+// it uses without taking kmem.lock.  Only when its magazine is
+// empty does it take MAGBATCH pages from the global free list,
+// and only when it is full does it give MAGBATCH back.  Pages in
+// other CPUs' magazines cannot be had: kalloc may fail with up
+// to NCPU*MAGSIZE pages free.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "kmem.h"
+
+#define MAGSIZE   32  // most free pages a CPU keeps
+#define MAGBATCH  16  // pages moved to or from the global list at once
 
 struct run {
   struct run *next;
 };
 
+struct magazine {
+  struct run *freelist;
+  int n;
+  uint nalloc;
+  uint nfree;
+};
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  uint nlock;
+  uint ncontended;
+  struct magazine mag[NCPU];  // per CPU; used with interrupts off
 } kmem;
 
 // Initialize free list of physical pages.
@@ -29,6 +51,36 @@ kinit(void)
     kfree(p);
 }
 
+// Take kmem.lock, counting how often it is taken and how
+// often another CPU has it.
+static void
+kmemlock(void)
+{
+  int busy;
+
+  busy = kmem.lock.locked;
+  acquire(&kmem.lock);
+  kmem.nlock++;
+  if(busy)
+    kmem.ncontended++;
+}
+
+// Move up to n pages from list *from to list *to.
+// Returns the number moved.
+static int
+kmove(struct run **from, struct run **to, int n)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < n && (r = *from) != 0; i++){
+    *from = r->next;
+    r->next = *to;
+    *to = r;
+  }
+  return i;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -37,6 +89,7 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct magazine *m;
 
   if(((uint) v) % PGSIZE || (uint)v < 1024*1024 || (uint)v >= PHYSTOP) 
     panic("kfree");
@@ -44,11 +97,19 @@ kfree(char *v)
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
-  acquire(&kmem.lock);
+  pushcli();
+  m = &kmem.mag[cpu - cpus];
+  if(m->n == MAGSIZE){
+    kmemlock();
+    m->n -= kmove(&m->freelist, &kmem.freelist, MAGBATCH);
+    release(&kmem.lock);
+  }
   r = (struct run *) v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  r->next = m->freelist;
+  m->freelist = r;
+  m->n++;
+  m->nfree++;
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -58,12 +119,38 @@ char*
 kalloc()
 {
   struct run *r;
+  struct magazine *m;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  pushcli();
+  m = &kmem.mag[cpu - cpus];
+  if(m->n == 0){
+    kmemlock();
+    m->n += kmove(&kmem.freelist, &m->freelist, MAGBATCH);
+    release(&kmem.lock);
+  }
+  r = m->freelist;
+  if(r){
+    m->freelist = r->next;
+    m->n--;
+    m->nalloc++;
+  }
+  popcli();
   return (char*) r;
 }
 
+// Copy the allocator's statistics to st.
+void
+kmemread(struct kmemstat *st)
+{
+  struct magazine *m;
+
+  acquire(&kmem.lock);
+  st->nlock = kmem.nlock;
+  st->ncontended = kmem.ncontended;
+  st->nalloc = st->nfree = 0;
+  for(m = kmem.mag; m < kmem.mag+NCPU; m++){
+    st->nalloc += m->nalloc;
+    st->nfree += m->nfree;
+  }
+  release(&kmem.lock);
+}
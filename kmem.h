@@ -0,0 +1,7 @@
+// Physical page allocator statistics, read with kmemstat(&st).
+struct kmemstat {
+  uint nalloc;      // pages allocated
+  uint nfree;       // pages freed
+  uint nlock;       // times the global free list's lock was taken
+  uint ncontended;  // of those, times another CPU held it
+};
@@ -0,0 +1,154 @@
+// LZ77 compression of file clusters.
+//
+// The format is a sequence of sequences, as in LZ4: a token
+// byte holding a literal count (high 4 bits) and a match length
+// minus LZMINMATCH (low 4 bits), extra count bytes for either if
+// its 4 bits are all ones, the literals, and a 2-byte offset back
+// to the match.  The last sequence has only literals.
+//
+// lzcompress finds matches through a hash table of recent
+// positions, which the caller provides (LZHASH ushorts), so
+// that it needs no memory of its own.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+
+#define LZMINMATCH 4
+
+static uint
+lzhash(uchar *p)
+{
+  uint v;
+
+  v = p[0] | p[1]<<8 | p[2]<<16 | p[3]<<24;
+  return ((v * 2654435761U) >> 16) & (LZHASH-1);
+}
+
+// Append count c beyond the 15 that fit in a token nibble.
+static int
+lzcount(uchar **op, uchar *oend, uint c)
+{
+  for(; c >= 255; c -= 255){
+    if(*op >= oend)
+      return -1;
+    *(*op)++ = 255;
+  }
+  if(*op >= oend)
+    return -1;
+  *(*op)++ = c;
+  return 0;
+}
+
+// Append a sequence: nlit literals at lit, then a match of
+// length mlen at distance off (none if mlen is 0).
+static int
+lzseq(uchar **op, uchar *oend, uchar *lit, uint nlit, uint off, uint mlen)
+{
+  uchar *token;
+  uint ml;
+
+  if(*op >= oend)
+    return -1;
+  token = (*op)++;
+  ml = mlen ? mlen - LZMINMATCH : 0;
+  *token = (nlit < 15 ? nlit : 15) << 4 | (ml < 15 ? ml : 15);
+  if(nlit >= 15 && lzcount(op, oend, nlit - 15) < 0)
+    return -1;
+  if(oend - *op < nlit)
+    return -1;
+  memmove(*op, lit, nlit);
+  *op += nlit;
+  if(mlen == 0)
+    return 0;
+  if(oend - *op < 2)
+    return -1;
+  *(*op)++ = off;
+  *(*op)++ = off >> 8;
+  if(ml >= 15 && lzcount(op, oend, ml - 15) < 0)
+    return -1;
+  return 0;
+}
+
+// Compress the n bytes at src into at most max bytes at dst.
+// n must be less than 65536.  Returns the compressed length,
+// or -1 if it would be more than max.
+int
+lzcompress(char *src, uint n, char *dst, uint max, ushort *tab)
+{
+  uchar *s, *ip, *anchor, *ref, *end, *op, *oend;
+  uint h, len;
+
+  s = (uchar*)src;
+  op = (uchar*)dst;
+  oend = op + max;
+  memset(tab, 0, LZHASH*sizeof(tab[0]));
+  anchor = s;
+  end = s + n;
+  for(ip = s; ip + LZMINMATCH <= end; ){
+    h = lzhash(ip);
+    ref = s + tab[h];
+    tab[h] = ip - s;
+    if(ref >= ip || memcmp(ref, ip, LZMINMATCH) != 0){
+      ip++;
+      continue;
+    }
+    for(len = LZMINMATCH; ip + len < end && ref[len] == ip[len]; len++)
+      ;
+    if(lzseq(&op, oend, anchor, ip - anchor, ip - ref, len) < 0)
+      return -1;
+    ip += len;
+    anchor = ip;
+  }
+  if(lzseq(&op, oend, anchor, end - anchor, 0, 0) < 0)
+    return -1;
+  return op - (uchar*)dst;
+}
+
+// Decompress the n bytes at src into at most max bytes at dst.
+// Returns the decompressed length, or -1 if src is corrupt.
+int
+lzdecompress(char *src, uint n, char *dst, uint max)
+{
+  uchar *ip, *iend, *op, *ostart, *oend, *ref;
+  uint nlit, mlen, c;
+
+  ip = (uchar*)src;
+  iend = ip + n;
+  op = ostart = (uchar*)dst;
+  oend = op + max;
+  while(ip < iend){
+    nlit = *ip >> 4;
+    mlen = (*ip++ & 15) + LZMINMATCH;
+    if(nlit == 15){
+      do {
+        if(ip >= iend)
+          return -1;
+        nlit += c = *ip++;
+      } while(c == 255);
+    }
+    if(iend - ip < nlit || oend - op < nlit)
+      return -1;
+    memmove(op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if(ip == iend)
+      break;  // last sequence
+    if(iend - ip < 2)
+      return -1;
+    ref = op - (ip[0] | ip[1]<<8);
+    ip += 2;
+    if(mlen == 15 + LZMINMATCH){
+      do {
+        if(ip >= iend)
+          return -1;
+        mlen += c = *ip++;
+      } while(c == 255);
+    }
+    if(ref < ostart || ref >= op || oend - op < mlen)
+      return -1;
+    while(mlen-- > 0)  // may overlap: copy forward
+      *op++ = *ref++;
+  }
+  return op - ostart;
+}
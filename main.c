@@ -47,7 +47,11 @@ mainc(void)
   binit();         // buffer cache
   fileinit();      // file table
   iinit();         // inode cache
+  pcacheinit();    // file page cache
+  diskstatinit();  // disk statistics
   ideinit();       // disk
+  virtioinit();    // virtio disks
+  ahciinit();      // SATA disks
   if(!ismp)
     timerinit();   // uniprocessor timer
   userinit();      // first user process
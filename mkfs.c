@@ -5,23 +5,28 @@
 #include <fcntl.h>
 #include <assert.h>
 #include "types.h"
+#include "param.h"
 #include "fs.h"
 #define NOSTAT
 #include "stat.h"
 
-int nblocks = 995;
-int ninodes = 200;
-int size = 1024;
+int nblocks;
+int ninodes = 200;     // set with -i
+int size = 1024;       // blocks, set with -s
+int bsize = SECTSIZE;  // block size, set with -b
+int bpg;          // blocks per group
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
-uint freeblock;
+uint ngroups;
+uint ipg;
 uint usedblocks;
-uint bitblocks;
 uint freeinode = 1;
+uchar (*bitmap)[MAXBSIZE];     // bitmap block of each group
+uint gnext[MAXGROUPS];         // next block to try in each group
 
-void balloc(int);
+uint balloc(uint);
+void wbitmaps(void);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
@@ -56,18 +61,30 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
+  uint g;
   uint rootino, inum, off;
   struct dirent de;
-  char buf[512];
+  char buf[MAXBSIZE];
   struct dinode din;
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  for(; argc > 2 && argv[1][0] == '-'; argc -= 2, argv += 2){
+    if(strcmp(argv[1], "-b") == 0)
+      bsize = atoi(argv[2]);
+    else if(strcmp(argv[1], "-s") == 0)
+      size = atoi(argv[2]);
+    else if(strcmp(argv[1], "-i") == 0)
+      ninodes = atoi(argv[2]);
+    else
+      break;
+  }
+  if(argc < 2 || bsize < SECTSIZE || bsize > MAXBSIZE || (bsize & (bsize-1)) ||
+     size < 16 || ninodes < 1){
+    fprintf(stderr, "Usage: mkfs [-b blocksize] [-s blocks] [-i inodes] fs.img files...\n");
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct dirent)) == 0);
+  assert((SECTSIZE % sizeof(struct dinode)) == 0);
+  assert((SECTSIZE % sizeof(struct dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -75,23 +92,61 @@ main(int argc, char *argv[])
     exit(1);
   }
 
+  // Split the disk after the boot and super blocks into groups,
+  // each with ipg inodes, one bitmap block and one block of
+  // reference counts.
+  sb.bsize = xint(bsize);
+  bpg = bsize / 2;
+  assert(bpg <= BPB(&sb) && bpg*sizeof(ushort) <= bsize);
+  ngroups = (size - FSTART(&sb) + bpg - 1) / bpg;
+  ipg = (ninodes + ngroups - 1) / ngroups;
+  ipg = (ipg + IPB(&sb) - 1) / IPB(&sb) * IPB(&sb);
+  ninodes = ngroups * ipg;
+  // Directory entries hold 16-bit inode numbers.
+  if(ngroups > MAXGROUPS || ninodes > 0xffff){
+    fprintf(stderr, "mkfs: %d blocks is too large for %d-byte blocks\n", size, bsize);
+    exit(1);
+  }
+  bitmap = calloc(ngroups, MAXBSIZE);
+  assert(bitmap != 0);
+
   sb.size = xint(size);
-  sb.nblocks = xint(nblocks); // so whole disk is size sectors
   sb.ninodes = xint(ninodes);
+  sb.ngroups = xint(ngroups);
+  sb.bpg = xint(bpg);
+  sb.ipg = xint(ipg);
+
+  // Mark each group's inode, bitmap and count blocks in use,
+  // along with any bits past the end of a short last group.
+  usedblocks = FSTART(&sb);
+  for(g = 0; g < ngroups; g++){
+    for(i = 0; i < bpg; i++)
+      if(GSTART(g, &sb) + i < GDATA(g, &sb) || GSTART(g, &sb) + i >= size)
+        bitmap[g][i/8] |= 0x1 << (i%8);
+    gnext[g] = GDATA(g, &sb) - GSTART(g, &sb);
+    usedblocks += gnext[g];
+  }
+  nblocks = size - usedblocks;
+  sb.nblocks = xint(nblocks);
 
-  bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
-  freeblock = usedblocks;
-
-  printf("used %d (bit %d ninode %zu) free %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
-
-  assert(nblocks + usedblocks == size);
+  printf("used %d (%d groups of %d blocks, %d inodes each) free %d total %d of %d bytes\n",
+         usedblocks, ngroups, bpg, ipg, nblocks, size, bsize);
 
-  for(i = 0; i < nblocks + usedblocks; i++)
-    wsect(i, zeroes);
+  // Blocks not written below read as zeroes; a large image
+  // is mostly holes.
+  if(ftruncate(fsfd, (off_t)size * bsize) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
 
-  wsect(1, &sb);
+  // The super block is in sector SBSECT whatever the block size.
+  memset(buf, 0, SECTSIZE);
+  memmove(buf, &sb, sizeof(sb));
+  if(lseek(fsfd, SBSECT * SECTSIZE, 0) != SBSECT * SECTSIZE ||
+     write(fsfd, buf, SECTSIZE) != SECTSIZE){
+    perror("write super block");
+    exit(1);
+  }
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
@@ -137,11 +192,11 @@ main(int argc, char *argv[])
   // fix size of root inode dir
   rinode(rootino, &din);
   off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
+  off = ((off/bsize) + 1) * bsize;
   din.size = xint(off);
   winode(rootino, &din);
 
-  balloc(usedblocks);
+  wbitmaps();
 
   exit(0);
 }
@@ -149,11 +204,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)bsize, 0) != sec * (long)bsize){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, bsize) != bsize){
     perror("write");
     exit(1);
   }
@@ -162,19 +217,19 @@ wsect(uint sec, void *buf)
 uint
 i2b(uint inum)
 {
-  return (inum / IPB) + 2;
+  return IBLOCK(inum, &sb);
 }
 
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
   bn = i2b(inum);
   rsect(bn, buf);
-  dip = ((struct dinode*) buf) + (inum % IPB);
+  dip = ((struct dinode*) buf) + (inum % IPB(&sb));
   *dip = *ip;
   wsect(bn, buf);
 }
@@ -182,24 +237,24 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
   bn = i2b(inum);
   rsect(bn, buf);
-  dip = ((struct dinode*) buf) + (inum % IPB);
+  dip = ((struct dinode*) buf) + (inum % IPB(&sb));
   *ip = *dip;
 }
 
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)bsize, 0) != sec * (long)bsize){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, bsize) != bsize){
     perror("read");
     exit(1);
   }
@@ -212,27 +267,43 @@ ialloc(ushort type)
   struct dinode din;
 
   bzero(&din, sizeof(din));
-  din.type = xshort(type);
+  din.type = type;
   din.nlink = xshort(1);
   din.size = xint(0);
   winode(inum, &din);
   return inum;
 }
 
-void
-balloc(int used)
+// Allocate a data block for inode inum, in the inode's
+// group if it has room, else in the next group that does.
+uint
+balloc(uint inum)
 {
-  uchar buf[512];
-  int i;
-
-  printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512);
-  bzero(buf, 512);
-  for(i = 0; i < used; i++) {
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  uint g, i, b;
+
+  for(i = 0; i < ngroups; i++){
+    g = (inum / ipg + i) % ngroups;
+    for(; gnext[g] < bpg; gnext[g]++){
+      b = gnext[g];
+      if((bitmap[g][b/8] & (0x1 << (b%8))) == 0){
+        bitmap[g][b/8] |= 0x1 << (b%8);
+        usedblocks++;
+        return GSTART(g, &sb) + b;
+      }
+    }
   }
-  printf("balloc: write bitmap block at sector %zu\n", ninodes/IPB + 3);
-  wsect(ninodes / IPB + 3, buf);
+  fprintf(stderr, "mkfs: out of blocks\n");
+  exit(1);
+}
+
+void
+wbitmaps(void)
+{
+  uint g;
+
+  printf("balloc: first %d blocks have been allocated\n", usedblocks);
+  for(g = 0; g < ngroups; g++)
+    wsect(BBLOCK(g, &sb), bitmap[g]);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -243,40 +314,37 @@ iappend(uint inum, void *xp, int n)
   char *p = (char*) xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[512];
-  uint indirect[NINDIRECT];
+  char buf[MAXBSIZE];
+  uint indirect[MAXBSIZE / sizeof(uint)];
   uint x;
 
   rinode(inum, &din);
 
   off = xint(din.size);
   while(n > 0){
-    fbn = off / 512;
-    assert(fbn < MAXFILE);
+    fbn = off / bsize;
+    assert(fbn < MAXFILE(&sb));
     if(fbn < NDIRECT) {
       if(xint(din.addrs[fbn]) == 0) {
-        din.addrs[fbn] = xint(freeblock++);
-        usedblocks++;
+        din.addrs[fbn] = xint(balloc(inum));
       }
       x = xint(din.addrs[fbn]);
     } else {
       if(xint(din.addrs[NDIRECT]) == 0) {
         // printf("allocate indirect block\n");
-        din.addrs[NDIRECT] = xint(freeblock++);
-        usedblocks++;
+        din.addrs[NDIRECT] = xint(balloc(inum));
       }
       // printf("read indirect block\n");
       rsect(xint(din.addrs[NDIRECT]), (char*) indirect);
       if(indirect[fbn - NDIRECT] == 0) {
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        usedblocks++;
+        indirect[fbn - NDIRECT] = xint(balloc(inum));
         wsect(xint(din.addrs[NDIRECT]), (char*) indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
     }
-    n1 = min(n, (fbn + 1) * 512 - off);
+    n1 = min(n, (fbn + 1) * bsize - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
+    bcopy(p, buf + off - (fbn * bsize), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -0,0 +1,198 @@
+// Memory-mapped files.
+//
+// A mapping shares the pages of a file's page cache (pcache.c)
+// with the process: mmap fills the pages with pcacheget and
+// maps them directly into the page table, so loads and stores
+// reach the cached file data without system calls or copies.
+//
+// Read-only mappings may be private or shared.  Writable mappings
+// must be shared; pages the process modified (PTE_D) are written
+// back to the file when the mapping is removed.
+//
+// Mappings are placed just below USERTOP and grow down toward
+// the heap; growproc refuses to grow the heap into them.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "stat.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// Lowest address used by p's mappings (USERTOP if none).
+uint
+mmapbottom(struct proc *p)
+{
+  struct vma *v;
+  uint bottom;
+
+  bottom = USERTOP;
+  for(v = p->vma; v < p->vma+NMMAP; v++)
+    if(v->f && v->addr < bottom)
+      bottom = v->addr;
+  return bottom;
+}
+
+static int
+vmaperm(struct vma *v)
+{
+  return (v->prot & PROT_WRITE) ? PTE_W|PTE_U : PTE_U;
+}
+
+// Remove the pages of v from pgdir, writing modified pages
+// back to the file and dropping the page cache references.
+static void
+vmaunmap(struct vma *v, pde_t *pgdir)
+{
+  struct inode *ip;
+  uint a, pte, off;
+
+  ip = v->f->ip;
+  ilock(ip);
+  for(a = 0; a < v->len; a += PGSIZE){
+    if((pte = unmapuvmpage(pgdir, v->addr + a)) == 0)
+      continue;
+    off = v->off + a;
+    if((pte & PTE_D) && (v->flags & MAP_SHARED) && off < ip->size)
+      writei(ip, (char*)PTE_ADDR(pte), off, min(PGSIZE, ip->size - off));
+    pcacheput((char*)PTE_ADDR(pte));
+  }
+  iunlock(ip);
+}
+
+// Map len bytes of f, starting at page-aligned offset off,
+// into the current process.  Returns the address of the
+// mapping, or 0 on failure.
+char*
+mmap(struct file *f, uint len, int prot, int flags, uint off)
+{
+  struct vma *v, *nv;
+  struct inode *ip;
+  uint addr, a, pte;
+  char *page;
+
+  if(f->type != FD_INODE || !f->readable || len == 0 || off % PGSIZE)
+    return 0;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return 0;
+  if((prot & PROT_WRITE) && (!(flags & MAP_SHARED) || !f->writable))
+    return 0;
+
+  nv = 0;
+  for(v = proc->vma; v < proc->vma+NMMAP; v++){
+    if(v->f == 0){
+      nv = v;
+      break;
+    }
+  }
+  if(nv == 0)
+    return 0;
+
+  len = PGROUNDUP(len);
+  addr = mmapbottom(proc) - len;
+  if(len > USERTOP || addr < PGROUNDUP(proc->sz))
+    return 0;
+
+  ip = f->ip;
+  ilock(ip);
+  if(ip->type != T_FILE || off + len < off || off + len > PGROUNDUP(imaxsize(ip))){
+    iunlock(ip);
+    return 0;
+  }
+  nv->addr = addr;
+  nv->len = len;
+  nv->off = off;
+  nv->prot = prot;
+  nv->flags = flags;
+  for(a = 0; a < len; a += PGSIZE){
+    if((page = pcacheget(ip, (off + a) / PGSIZE)) == 0)
+      goto bad;
+    if(!mapuvmpage(proc->pgdir, addr + a, PADDR(page), vmaperm(nv))){
+      pcacheput(page);
+      goto bad;
+    }
+  }
+  iunlock(ip);
+  nv->f = filedup(f);
+  return (char*)addr;
+
+bad:
+  while(a > 0){
+    a -= PGSIZE;
+    pte = unmapuvmpage(proc->pgdir, addr + a);
+    pcacheput((char*)PTE_ADDR(pte));
+  }
+  iunlock(ip);
+  return 0;
+}
+
+// Remove the mapping of the current process starting at addr.
+// Only whole mappings can be removed.
+int
+munmap(uint addr, uint len)
+{
+  struct vma *v;
+
+  for(v = proc->vma; v < proc->vma+NMMAP; v++){
+    if(v->f && v->addr == addr){
+      if(PGROUNDUP(len) != v->len)
+        return -1;
+      vmaunmap(v, proc->pgdir);
+      fileclose(v->f);
+      v->f = 0;
+      switchuvm(proc);  // flush stale TLB entries
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Give child np the same mappings as p, sharing the pages.
+// On failure, np is left with no mappings.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  uint a;
+  char *pa;
+
+  for(v = p->vma, nv = np->vma; v < p->vma+NMMAP; v++, nv++){
+    if(v->f == 0)
+      continue;
+    *nv = *v;
+    nv->f = filedup(v->f);
+    for(a = 0; a < v->len; a += PGSIZE){
+      pa = uva2ka(p->pgdir, (char*)(v->addr + a));
+      pcachedup(pa);
+      if(!mapuvmpage(np->pgdir, v->addr + a, PADDR(pa), vmaperm(v))){
+        pcacheput(pa);
+        mmapexit(np, np->pgdir);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Remove all of p's mappings from pgdir.
+// Called by exit, and by exec on the old page table,
+// before the page table is freed.
+void
+mmapexit(struct proc *p, pde_t *pgdir)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < p->vma+NMMAP; v++){
+    if(v->f){
+      vmaunmap(v, pgdir);
+      fileclose(v->f);
+      v->f = 0;
+    }
+  }
+}
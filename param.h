@@ -6,7 +6,14 @@
 #define NBUF         10  // size of disk block cache
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
-#define ROOTDEV       1  // device number of file system root disk
+#define ROOTDEV       1  // device number of file system root disk (4 for virtio)
 #define PHYSTOP  0x1000000 // use phys mem up to here as free pool
+#define NPCACHE      64  // pages in the file page cache
+#define NMMAP         8  // memory-mapped regions per process
+#define MAXGROUPS  1024  // maximum block groups per file system
+#define MAXBSIZE   4096  // largest file system block size
+#define NDISK         8  // disks: 4 IDE, 2 virtio, 2 AHCI
+#define LZHASH     2048  // entries in lzcompress's hash table
+#define NREADAHEAD    4  // blocks read ahead for FADV_SEQUENTIAL
 #define HASHSIZE	  10
 #define SRP 		  5
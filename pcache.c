@@ -0,0 +1,229 @@
+// File page cache.
+//
+// The page cache holds whole 4096-byte pages of file data,
+// keyed by (dev, inum, page number).  It sits above the
+// buffer cache: a page is filled once with ireadpage, which
+// also decompresses compressed clusters, and can then
+// be mapped straight into user page tables by mmap, or copied
+// from directly by readi without going through bread.
+//
+// Interface:
+// * pcacheget returns a filled page with a reference held.
+//     The caller must hold the inode lock, perhaps shared:
+//     a page being filled is marked PC_FILL, and others
+//     wanting it wait for the filler.
+// * pcachedup and pcacheput take and drop extra references.
+// * pcacheread and pcachewrite copy to and from a cached page
+//     if one is present; readi and writei use them to keep
+//     the cache coherent with ordinary file I/O.
+// * pcacheinval drops all cached pages of an inode.
+//
+// Pages with ref == 0 stay cached and are reused in least
+// recently used order.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "file.h"
+
+#define PC_VALID 0x1  // page holds file data
+#define PC_FILL  0x2  // page is being read in
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint pgno;          // page number within the file
+  int ref;            // mappings and callers using the page
+  int flags;
+  uint used;          // last use, for LRU replacement
+  char *page;
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage pages[NPCACHE];
+  uint clock;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Find the valid cached page pgno of ip.  Caller holds pcache.lock.
+static struct pcpage*
+pcachefind(struct inode *ip, uint pgno)
+{
+  struct pcpage *p;
+
+  for(p = pcache.pages; p < pcache.pages+NPCACHE; p++)
+    if((p->flags & PC_VALID) && p->dev == ip->dev &&
+       p->inum == ip->inum && p->pgno == pgno)
+      return p;
+  return 0;
+}
+
+// Return page pgno of locked inode ip, reading it in if necessary.
+// Returns 0 if no page can be allocated.
+char*
+pcacheget(struct inode *ip, uint pgno)
+{
+  struct pcpage *p, *victim;
+  char *page;
+
+  if(!(ip->flags & I_BUSY) && ip->readers == 0)
+    panic("pcacheget");
+
+  acquire(&pcache.lock);
+again:
+  if((p = pcachefind(ip, pgno)) != 0){
+    p->ref++;
+    p->used = ++pcache.clock;
+    release(&pcache.lock);
+    return p->page;
+  }
+  for(p = pcache.pages; p < pcache.pages+NPCACHE; p++){
+    if((p->flags & PC_FILL) && p->dev == ip->dev &&
+       p->inum == ip->inum && p->pgno == pgno){
+      sleep(p, &pcache.lock);
+      goto again;
+    }
+  }
+
+  // Recycle the least recently used unreferenced page.
+  victim = 0;
+  for(p = pcache.pages; p < pcache.pages+NPCACHE; p++){
+    if(p->ref != 0)
+      continue;
+    if(victim == 0 || p->used < victim->used)
+      victim = p;
+  }
+  if(victim == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  p = victim;
+  p->dev = ip->dev;
+  p->inum = ip->inum;
+  p->pgno = pgno;
+  p->ref = 1;
+  p->flags = PC_FILL;
+  p->used = ++pcache.clock;
+  page = p->page;
+  release(&pcache.lock);
+
+  if(page == 0 && (page = kalloc()) == 0){
+    acquire(&pcache.lock);
+    p->ref = 0;
+    p->flags = 0;
+    wakeup(p);
+    release(&pcache.lock);
+    return 0;
+  }
+  if(ireadpage(ip, pgno, page) < 0){
+    acquire(&pcache.lock);
+    p->page = page;
+    p->ref = 0;
+    p->flags = 0;
+    wakeup(p);
+    release(&pcache.lock);
+    return 0;
+  }
+
+  acquire(&pcache.lock);
+  p->page = page;
+  p->flags = PC_VALID;
+  wakeup(p);
+  release(&pcache.lock);
+  return page;
+}
+
+// Drop a reference to a page returned by pcacheget.
+void
+pcacheput(char *page)
+{
+  struct pcpage *p;
+
+  acquire(&pcache.lock);
+  for(p = pcache.pages; p < pcache.pages+NPCACHE; p++){
+    if(p->page == page){
+      if(p->ref < 1)
+        panic("pcacheput");
+      p->ref--;
+      release(&pcache.lock);
+      return;
+    }
+  }
+  panic("pcacheput: no page");
+}
+
+// Take another reference to a page returned by pcacheget.
+void
+pcachedup(char *page)
+{
+  struct pcpage *p;
+
+  acquire(&pcache.lock);
+  for(p = pcache.pages; p < pcache.pages+NPCACHE; p++){
+    if(p->page == page){
+      if(p->ref < 1)
+        panic("pcachedup");
+      p->ref++;
+      release(&pcache.lock);
+      return;
+    }
+  }
+  panic("pcachedup: no page");
+}
+
+// Copy n bytes at offset off of ip from the page cache to dst.
+// The range must lie within one page.
+// Returns n, or -1 if the page is not cached.
+int
+pcacheread(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct pcpage *p;
+
+  acquire(&pcache.lock);
+  if((p = pcachefind(ip, off/PGSIZE)) == 0){
+    release(&pcache.lock);
+    return -1;
+  }
+  p->used = ++pcache.clock;
+  memmove(dst, p->page + off%PGSIZE, n);
+  release(&pcache.lock);
+  return n;
+}
+
+// Copy n bytes from src into the cached page of ip holding off,
+// if there is one.  The range must lie within one page.
+void
+pcachewrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct pcpage *p;
+
+  acquire(&pcache.lock);
+  if((p = pcachefind(ip, off/PGSIZE)) != 0)
+    memmove(p->page + off%PGSIZE, src, n);
+  release(&pcache.lock);
+}
+
+// Discard all cached pages of ip.  Pages still mapped
+// stay allocated until their last pcacheput.
+void
+pcacheinval(struct inode *ip)
+{
+  struct pcpage *p;
+
+  acquire(&pcache.lock);
+  for(p = pcache.pages; p < pcache.pages+NPCACHE; p++)
+    if(p->dev == ip->dev && p->inum == ip->inum)
+      p->flags &= ~PC_VALID;
+  release(&pcache.lock);
+}
@@ -0,0 +1,82 @@
+// PCI configuration space access, through the legacy
+// configuration mechanism #1 (ports 0xcf8 and 0xcfc).
+//
+// Drivers find their devices with pcifind, and read and set
+// configuration registers with pciread and pciwrite.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_ADDR  0xcf8
+#define PCI_DATA  0xcfc
+
+// Select register off of a function for the next PCI_DATA access.
+static void
+pcisel(uint bus, uint dev, uint func, uint off)
+{
+  outl(PCI_ADDR, 0x80000000 | bus<<16 | dev<<11 | func<<8 | (off & 0xfc));
+}
+
+static uint
+pciconf(uint bus, uint dev, uint func, uint off)
+{
+  pcisel(bus, dev, func, off);
+  return inl(PCI_DATA);
+}
+
+uint
+pciread(struct pcidev *d, uint off)
+{
+  return pciconf(d->bus, d->dev, d->func, off);
+}
+
+void
+pciwrite(struct pcidev *d, uint off, uint v)
+{
+  pcisel(d->bus, d->dev, d->func, off);
+  outl(PCI_DATA, v);
+}
+
+// Find the n'th function (counting from 0) that matches vendor,
+// device, class and subclass, any of which may be PCI_ANY, and
+// fill in *d.  Returns -1 if there is none.
+int
+pcifind(int vendor, int device, int class, int subclass, int n, struct pcidev *d)
+{
+  uint bus, dev, func, nfunc, id, cl, i;
+
+  for(bus = 0; bus < 256; bus++){
+    for(dev = 0; dev < 32; dev++){
+      nfunc = 1;
+      for(func = 0; func < nfunc; func++){
+        if((id = pciconf(bus, dev, func, PCI_ID)) == 0xffffffff)
+          continue;
+        if(func == 0 && (pciconf(bus, dev, 0, PCI_HEADER) & 0x800000))
+          nfunc = 8;  // multi-function device
+        cl = pciconf(bus, dev, func, PCI_CLASS);
+        if((vendor != PCI_ANY && (id & 0xffff) != vendor) ||
+           (device != PCI_ANY && (id >> 16) != device) ||
+           (class != PCI_ANY && (cl >> 24) != class) ||
+           (subclass != PCI_ANY && ((cl >> 16) & 0xff) != subclass))
+          continue;
+        if(n-- > 0)
+          continue;
+        d->bus = bus;
+        d->dev = dev;
+        d->func = func;
+        d->vendor = id & 0xffff;
+        d->device = id >> 16;
+        d->class = cl >> 24;
+        d->subclass = cl >> 16;
+        d->progif = cl >> 8;
+        d->irq = pciconf(bus, dev, func, PCI_INTR);
+        for(i = 0; i < 6; i++)
+          d->bar[i] = pciconf(bus, dev, func, PCI_BAR0 + 4*i);
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,31 @@
+// PCI devices, as found by pcifind.
+
+struct pcidev {
+  uint bus;
+  uint dev;
+  uint func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;          // legacy interrupt line
+  uint bar[6];        // base address registers, as read
+};
+
+// Configuration space registers
+#define PCI_ID        0x00  // vendor (low 16 bits), device
+#define PCI_COMMAND   0x04
+#define PCI_CLASS     0x08  // revision, prog-if, subclass, class
+#define PCI_HEADER    0x0c  // header type in bits 16-23
+#define PCI_BAR0      0x10
+#define PCI_INTR      0x3c  // interrupt line (low 8 bits)
+
+// PCI_COMMAND bits
+#define PCI_CMD_IO      0x1  // respond to I/O space accesses
+#define PCI_CMD_MEM     0x2  // respond to memory space accesses
+#define PCI_CMD_MASTER  0x4  // may do bus master DMA
+
+#define PCI_BAR_IO      0x1  // BAR is an I/O port base
+
+#define PCI_ANY        (-1)
@@ -94,6 +94,43 @@ pipewrite(struct pipe *p, char *addr, int n)
   return n;
 }
 
+// Copy up to n bytes into p without sleeping, as many as fit.
+// Returns the number copied, or -1 if no one reads p.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  int i;
+
+  acquire(&p->lock);
+  if(p->readopen == 0 || proc->killed){
+    release(&p->lock);
+    return -1;
+  }
+  for(i = 0; i < n && p->nwrite != p->nread + PIPESIZE; i++)
+    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+  if(i > 0)
+    wakeup(&p->nread);
+  release(&p->lock);
+  return i;
+}
+
+// Wait until p has room.  Returns -1 if no one reads p.
+int
+pipewait(struct pipe *p)
+{
+  acquire(&p->lock);
+  while(p->nwrite == p->nread + PIPESIZE){
+    if(p->readopen == 0 || proc->killed){
+      release(&p->lock);
+      return -1;
+    }
+    wakeup(&p->nread);
+    sleep(&p->nwrite, &p->lock);
+  }
+  release(&p->lock);
+  return 0;
+}
+
 int
 piperead(struct pipe *p, char *addr, int n)
 {
@@ -141,6 +141,8 @@ growproc(int n)
 {
   uint sz = proc->sz;
   if(n > 0){
+    if(sz + n > mmapbottom(proc))
+      return -1;
     if(!(sz = allocuvm(proc->pgdir, sz, sz + n)))
       return -1;
   } else if(n < 0){
@@ -172,6 +174,13 @@ fork(void)
     np->state = UNUSED;
     return -1;
   }
+  if(mmapfork(proc, np) < 0){
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
   np->sz = proc->sz;
   np->parent = proc;
   *np->tf = *proc->tf;
@@ -210,6 +219,9 @@ exit(void)
     }
   }
 
+  // Write back and remove memory-mapped files.
+  mmapexit(proc, proc->pgdir);
+
   iput(proc->cwd);
   proc->cwd = 0;
 
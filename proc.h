@@ -55,6 +55,16 @@ struct context {
   uint eip;
 };
 
+// Memory-mapped region of a file (see mmap.c)
+struct vma {
+  uint addr;                   // Start address (page-aligned)
+  uint len;                    // Length in bytes (page multiple)
+  uint off;                    // File offset of first page
+  int prot;                    // PROT_READ, PROT_WRITE
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // Mapped file, 0 if slot is free
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -72,6 +82,7 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct vma vma[NMMAP];       // Memory-mapped files
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -79,3 +90,6 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+//   ...
+//   memory-mapped files, growing down from USERTOP
+#define USERTOP  0xA0000
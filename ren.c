@@ -6,19 +6,15 @@
 int
 main(int argint, char *args[])
 {
-	if (argint != 4) {
-          printf(1, "USAGE: ren <path> <old_name> <new_name>\n");
+	if (argint != 3) {
+          printf(1, "USAGE: ren <old_path> <new_path>\n");
 	  exit();
         }
-	char *path = args[1];
-	char *old = args[2];
-	char *new = args[3];
-	int res = rename(path, old, new);
+	char *old = args[1];
+	char *new = args[2];
+	int res = rename(old, new);
 	if(res == -1) {
-	  printf(1, "Error: File does not exsist or invalid path name\n");
-        }
-	if(res == -2) {
-	  printf(1, "Error: File target already exist\n");
+	  printf(1, "Error: cannot rename %s to %s\n", old, new);
         }
 	exit();
 }
@@ -99,6 +99,22 @@ extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_rename(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_sendfile(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_lseek(void);
+extern int sys_sync(void);
+extern int sys_clone(void);
+extern int sys_defrag(void);
+extern int sys_compress(void);
+extern int sys_fadvise(void);
+extern int sys_diskctl(void);
+extern int sys_diskstat(void);
+extern int sys_kmemstat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_chdir]   sys_chdir,
@@ -123,6 +139,22 @@ static int (*syscalls[])(void) = {
 [SYS_write]   sys_write,
 [SYS_uptime]  sys_uptime,
 [SYS_rename]  sys_rename,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_sendfile] sys_sendfile,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_lseek]   sys_lseek,
+[SYS_sync]    sys_sync,
+[SYS_clone]   sys_clone,
+[SYS_defrag]  sys_defrag,
+[SYS_compress] sys_compress,
+[SYS_fadvise] sys_fadvise,
+[SYS_diskctl] sys_diskctl,
+[SYS_diskstat] sys_diskstat,
+[SYS_kmemstat] sys_kmemstat,
 };
 
 void
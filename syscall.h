@@ -21,3 +21,19 @@
 #define SYS_sleep  20
 #define SYS_uptime 21
 #define SYS_rename 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_sendfile 25
+#define SYS_pread  26
+#define SYS_pwrite 27
+#define SYS_readv  28
+#define SYS_writev 29
+#define SYS_lseek  30
+#define SYS_sync   31
+#define SYS_clone  32
+#define SYS_defrag 33
+#define SYS_compress 34
+#define SYS_fadvise 35
+#define SYS_diskctl 36
+#define SYS_diskstat 37
+#define SYS_kmemstat 38
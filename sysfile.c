@@ -7,6 +7,8 @@
 #include "fs.h"
 #include "file.h"
 #include "fcntl.h"
+#include "buf.h"
+#include "disk.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -229,7 +231,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -287,6 +289,7 @@ sys_open(void)
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
+  f->advice = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
   return fd;
@@ -398,69 +401,409 @@ strcmp(const char *p, const char *q)
   return (uchar)*p - (uchar)*q;
 }
 
-//Rename file system call
+// If directory a is an ancestor of directory d, other than d
+// itself, return a's child on the way down to d, with a new
+// reference; otherwise 0.  Caller holds the rename lock, so
+// no directory moves, and no inode locks.
+static struct inode*
+childtoward(struct inode *a, struct inode *d)
+{
+  struct inode *ip, *next;
+
+  ip = idup(d);
+  for(;;){
+    ilock(ip);
+    next = dirlookup(ip, "..", 0);
+    iunlock(ip);
+    if(next == a){
+      iput(next);
+      return ip;
+    }
+    if(next == 0 || next == ip){  // reached the root
+      if(next)
+        iput(next);
+      iput(ip);
+      return 0;
+    }
+    iput(ip);
+    ip = next;
+  }
+}
+
+// Rename old to new, replacing new if it exists.  Files and
+// directories may move between directories; a directory may
+// only replace an empty directory, and cannot move into itself.
+// Each directory is scanned once, and a rename within one
+// directory writes only its directory block (and the inode
+// of a replaced file).
 int
 sys_rename(void)
 {
-  char *path, *oldname, *newname;
-  uint off;
-  struct inode *ip, *dp;
-  char name[DIRSIZ];
-  int off2, i, offsettowrite;
-  struct dirent *de=0;
-  struct dirent oldf;
-  int newfileexists=0;
-  int oldfileexists=0;
+  char oname[DIRSIZ], nname[DIRSIZ], *old, *new, *names[2];
+  uint offs[2], empty;
+  struct inode *odp, *ndp, *ip, *tp, *ips[2], *ochild, *nchild;
+  struct dirent de;
+  int r;
 
-  offsettowrite = 0;
-  //Reading the args
-  if(argstr(0, &path) < 0 || argstr(1, &oldname) < 0 || argstr(2, &newname) < 0) {
+  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+    return -1;
+  if((odp = nameiparent(old, oname)) == 0)
+    return -1;
+  if((ndp = nameiparent(new, nname)) == 0){
+    iput(odp);
     return -1;
   }
-  //Getting the inode of the parent directory
-  if((dp = nameiparent(path, name)) == 0)
+  if(namecmp(oname, ".") == 0 || namecmp(oname, "..") == 0 ||
+     namecmp(nname, ".") == 0 || namecmp(nname, "..") == 0 ||
+     odp->dev != ndp->dev){
+    iput(ndp);
+    iput(odp);
     return -1;
-  ilock(dp);
+  }
 
-  if((ip = dirlookup(dp, name, &off)) != 0){
-    iunlockput(dp);
+  r = -1;
+  renamelock();
+
+  // Where the directories lie relative to each other:
+  // ochild is ndp's child above odp, nchild odp's above ndp.
+  ochild = nchild = 0;
+  if(odp != ndp && (ochild = childtoward(ndp, odp)) == 0)
+    nchild = childtoward(odp, ndp);
+
+  // Lock an ancestor before its descendant, as unlink does.
+  if(odp == ndp)
+    ilock(odp);
+  else if(ochild){
+    ilock(ndp);
+    ilock(odp);
+  } else {
+    ilock(odp);
+    ilock(ndp);
+  }
+  names[0] = oname;
+  names[1] = nname;
+  if(odp == ndp)
+    empty = dirscan(odp, names, ips, offs, 2);
+  else {
+    dirscan(odp, names, ips, offs, 1);
+    empty = dirscan(ndp, names+1, ips+1, offs+1, 1);
+  }
+  ip = ips[0];
+  tp = ips[1];
+  if(ip == 0)
+    goto unlock;
+  if(tp == ip){
+    r = 0;
+    goto unlock;
+  }
+  // A directory cannot move below itself, and a directory above
+  // odp is not empty; checking here also keeps us from locking
+  // it after odp.
+  if(ip == nchild || tp == odp || (tp && tp == ochild))
+    goto unlock;
+
+  if(tp){
+    if(ip < tp){
+      ilock(ip);
+      ilock(tp);
+    } else {
+      ilock(tp);
+      ilock(ip);
+    }
+    if(tp->type == T_DIR ? ip->type != T_DIR || !isdirempty(tp) : ip->type == T_DIR){
+      iunlock(tp);
+      iunlock(ip);
+      goto unlock;
+    }
+  } else
     ilock(ip);
 
-    //Searching the directory for newfile and oldfile. dirent by dirent.
-    for(off2=2*sizeof(*de); off2<ip->size; off2+=sizeof(*de)){
-      if(readi(ip, (char*)de, off2, sizeof(*de)) != sizeof(*de))
-      panic("isdirempty: readi");
-      if(strcmp(de->name, oldname) == 0) {
-        oldfileexists=1;
-	oldf=*de;
-	offsettowrite = off2;
-      }
-      if(strcmp(de->name, newname) == 0) {
-        newfileexists=1;
-      }
+  // Link the new name before removing the old one.
+  memset(&de, 0, sizeof(de));
+  de.inum = ip->inum;
+  strncpy(de.name, nname, DIRSIZ);
+  if(writei(ndp, (char*)&de, tp ? offs[1] : empty, sizeof(de)) != sizeof(de))
+    panic("rename: writei");
+  memset(&de, 0, sizeof(de));
+  if(writei(odp, (char*)&de, offs[0], sizeof(de)) != sizeof(de))
+    panic("rename: writei");
+
+  if(ip->type == T_DIR && odp != ndp){
+    de.inum = ndp->inum;
+    strncpy(de.name, "..", DIRSIZ);
+    if(writei(ip, (char*)&de, sizeof(de), sizeof(de)) != sizeof(de))
+      panic("rename: writei");
+    odp->nlink--;
+    iupdate(odp);
+    ndp->nlink++;
+    iupdate(ndp);
+  }
+  if(tp){
+    if(tp->type == T_DIR){
+      ndp->nlink--;
+      iupdate(ndp);
     }
-    if(oldfileexists == 0) {
-      //Source file is not in the directory
-      iunlockput(ip);
+    tp->nlink--;
+    iupdate(tp);
+    iunlock(tp);
+  }
+  iunlock(ip);
+  r = 0;
+
+unlock:
+  if(odp != ndp)
+    iunlock(ndp);
+  iunlock(odp);
+  renameunlock();
+  if(tp)
+    iput(tp);
+  if(ip)
+    iput(ip);
+  if(ochild)
+    iput(ochild);
+  if(nchild)
+    iput(nchild);
+  iput(ndp);
+  iput(odp);
+  return r;
+}
+
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int len, prot, flags, off;
+  char *addr;
+
+  // Argument 0 is an address hint, which is ignored.
+  if(argint(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || (addr = mmap(f, len, prot, flags, off)) == 0)
+    return -1;
+  return (int)addr;
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 ||
+     argint(2, &off) < 0 || argint(3, &n) < 0 || n < 0)
+    return -1;
+  return filesend(out, in, off, n);
+}
+
+// Fetch the iovec array argument n with cnt entries into iov,
+// checking that every segment lies in the process address space.
+static int
+argiovec(int n, struct iovec *iov, int cnt)
+{
+  struct iovec *uiov;
+  int i;
+
+  if(cnt < 0 || cnt > IOV_MAX || argptr(n, (void*)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  for(i = 0; i < cnt; i++){
+    iov[i] = uiov[i];
+    if(iov[i].len < 0 || (uint)iov[i].base >= proc->sz ||
+       (uint)iov[i].base + iov[i].len >= proc->sz)
       return -1;
-    }
-    if(newfileexists == 1) {
-      //Target file is already exist in the directory
-      iunlockput(ip);
-      return -2;
-    }
-    for(i=0; i<DIRSIZ; i++) {
-      oldf.name[i] = 0;
-    }
-    //Updating the diren name and then writing it back
-    for(i=0; i<DIRSIZ && i<strlen(newname); i++) {
-      oldf.name[i] = newname[i];
-    }
-    if(writei(ip, (char*)&oldf, offsettowrite, sizeof(oldf)) != sizeof(oldf))
-    panic("unlink: writei");
-    iunlockput(ip);
-    return 0;
   }
-  iunlockput(dp);
-  return -1;
+  return 0;
+}
+
+int
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.base = p;
+  iov.len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.base = p;
+  iov.len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiovec(1, iov, cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiovec(1, iov, cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
+int
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+int
+sys_sync(void)
+{
+  isync();
+  return 0;
+}
+
+// Create path as a copy of the file open as fd.  The copy
+// shares the file's blocks until one of them is written.
+int
+sys_clone(void)
+{
+  char *path;
+  struct file *f;
+  struct inode *ip, *sp;
+  int r;
+
+  if(argfd(0, 0, &f) < 0 || argstr(1, &path) < 0)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if((ip = create(path, T_FILE, 0, 0)) == 0)
+    return -1;
+  iunlock(ip);
+  sp = f->ip;
+  if(ip == sp){
+    iput(ip);
+    return -1;
+  }
+  // Lock in address order so that two opposite
+  // clones cannot deadlock.
+  if(sp < ip){
+    ilock(sp);
+    ilock(ip);
+  } else {
+    ilock(ip);
+    ilock(sp);
+  }
+  r = iclone(ip, sp);
+  iunlock(sp);
+  iunlockput(ip);
+  return r;
+}
+
+// Return the number of extents of the file open as fd,
+// moving its blocks into one extent first if move is set.
+int
+sys_defrag(void)
+{
+  struct file *f;
+  int move, r;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &move) < 0)
+    return -1;
+  if(f->type != FD_INODE || (move && !f->writable))
+    return -1;
+  ilock(f->ip);
+  r = idefrag(f->ip, move);
+  iunlock(f->ip);
+  return r;
+}
+
+int
+sys_compress(void)
+{
+  struct file *f;
+  int r;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE || !f->writable)
+    return -1;
+  ilock(f->ip);
+  r = icompress(f->ip);
+  iunlock(f->ip);
+  return r;
+}
+
+int
+sys_fadvise(void)
+{
+  struct file *f;
+  int off, len, advice;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0 ||
+     argint(3, &advice) < 0)
+    return -1;
+  return fileadvise(f, off, len, advice);
+}
+
+int
+sys_diskctl(void)
+{
+  int dev, op, val;
+
+  if(argint(0, &dev) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  if(dev < 0 || dev >= NDISK || bdevsw[dev].ctl == 0)
+    return -1;
+  return bdevsw[dev].ctl(dev, op, val);
+}
+
+int
+sys_diskstat(void)
+{
+  int dev;
+  struct diskstat *st;
+
+  if(argint(0, &dev) < 0 || argptr(1, (char**)&st, sizeof(*st)) < 0)
+    return -1;
+  if(dev < 0 || dev >= NDISK || bdevsw[dev].rw == 0)
+    return -1;
+  diskstatread(dev, st);
+  return 0;
 }
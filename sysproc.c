@@ -4,6 +4,7 @@
 #include "param.h"
 #include "mmu.h"
 #include "proc.h"
+#include "kmem.h"
 
 int
 sys_fork(void)
@@ -87,3 +88,14 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+int
+sys_kmemstat(void)
+{
+  struct kmemstat *st;
+
+  if(argptr(0, (char**)&st, sizeof(*st)) < 0)
+    return -1;
+  kmemread(st);
+  return 0;
+}
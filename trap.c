@@ -55,7 +55,11 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
-    ideintr();
+    ideintr(0);
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_IDE2:
+    ideintr(1);
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_KBD:
@@ -74,6 +78,13 @@ trap(struct trapframe *tf)
     break;
    
   default:
+    // PCI devices use the interrupt line the BIOS gave them,
+    // which they may share.
+    if(tf->trapno >= T_IRQ0 &&
+       virtiointr(tf->trapno - T_IRQ0) + ahciintr(tf->trapno - T_IRQ0) > 0){
+      lapiceoi();
+      break;
+    }
     if(proc == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
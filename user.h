@@ -1,4 +1,7 @@
 struct stat;
+struct iovec;
+struct diskstat;
+struct kmemstat;
 
 // system calls
 int fork(void);
@@ -22,7 +25,23 @@ int getpid();
 char* sbrk(int);
 int sleep(int);
 int uptime();
-int rename(char*, char*, char*);
+int rename(char*, char*);
+char* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int sendfile(int, int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, void*, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int lseek(int, int, int);
+int sync(void);
+int clone(int, char*);
+int defrag(int, int);
+int compress(int);
+int fadvise(int, int, int, int);
+int diskctl(int, int, int);
+int diskstat(int, struct diskstat*);
+int kmemstat(struct kmemstat*);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -3,6 +3,8 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "disk.h"
+#include "kmem.h"
 #include "syscall.h"
 #include "traps.h"
 
@@ -11,6 +13,10 @@ char name[3];
 char *echoargv[] = { "echo", "ALL", "TESTS", "PASSED", 0 };
 int stdout = 1;
 
+// Blocks in the largest file with 512-byte blocks,
+// which any file system can hold.
+#define BIGBLOCKS (NDIRECT + SECTSIZE/sizeof(uint))
+
 // simple file system tests
 
 void
@@ -95,7 +101,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++) {
+  for(i = 0; i < BIGBLOCKS; i++) {
     ((int*) buf)[0] = i;
     if(write(fd, buf, 512) != 512) {
       printf(stdout, "error: write big file failed\n", i);
@@ -115,7 +121,7 @@ writetest1(void)
   for(;;) {
     i = read(fd, buf, 512);
     if(i == 0) {
-      if(n == MAXFILE - 1) {
+      if(n == BIGBLOCKS - 1) {
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -404,6 +410,298 @@ sharedfd(void)
     printf(1, "sharedfd oops %d %d\n", nc, np);
 }
 
+// four processes read one file at the same time,
+// each through its own file descriptor.
+void
+sharedread(void)
+{
+  int fd, pid, i, j, k;
+
+  printf(1, "sharedread test\n");
+
+  unlink("sharedread");
+  fd = open("sharedread", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create sharedread\n");
+    exit();
+  }
+  for(i = 0; i < 16; i++){
+    memset(buf, 'a' + i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(1, "write sharedread failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  for(k = 0; k < 4; k++){
+    if((pid = fork()) < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      fd = open("sharedread", 0);
+      for(j = 0; j < 20; j++){
+        for(i = 0; i < 16; i++){
+          if(pread(fd, buf, 512, i*512) != 512 || buf[0] != 'a' + i || buf[511] != 'a' + i){
+            printf(1, "sharedread wrong data\n");
+            exit();
+          }
+        }
+      }
+      close(fd);
+      exit();
+    }
+  }
+  for(k = 0; k < 4; k++)
+    wait();
+  unlink("sharedread");
+
+  printf(1, "sharedread ok\n");
+}
+
+// access hints must not change what reads return.
+void
+fadvisetest(void)
+{
+  int fd, i, n, fds[2];
+
+  printf(1, "fadvise test\n");
+
+  unlink("fadvise");
+  fd = open("fadvise", O_CREATE | O_RDWR);
+  // past NDIRECT, so WILLNEED also reads the indirect block
+  // while the direct blocks are being prefetched.
+  for(i = 0; i < NDIRECT+8; i++){
+    memset(buf, 'a' + i, 512);
+    write(fd, buf, 512);
+  }
+  close(fd);
+
+  fd = open("fadvise", 0);
+  if(fadvise(fd, 0, 0, FADV_WILLNEED) != 0 || fadvise(fd, 0, 0, FADV_SEQUENTIAL) != 0 ||
+     fadvise(fd, 0, 0, FADV_NOREUSE) != 0 || fadvise(fd, 0, 0, 99) == 0){
+    printf(1, "fadvise failed\n");
+    exit();
+  }
+  for(n = 0; n < 2; n++){
+    for(i = 0; i < NDIRECT+8; i++){
+      if(read(fd, buf, 512) != 512 || buf[0] != 'a' + i || buf[511] != 'a' + i){
+        printf(1, "fadvise wrong data\n");
+        exit();
+      }
+    }
+    // drop the whole file and prefetch it again
+    if(fadvise(fd, 0, 0, FADV_DONTNEED) != 0 || fadvise(fd, 0, 0, FADV_WILLNEED) != 0){
+      printf(1, "fadvise willneed failed\n");
+      exit();
+    }
+    lseek(fd, 0, SEEK_SET);
+  }
+  if(fadvise(fd, 512, 1024, FADV_DONTNEED) != 0 || pread(fd, buf, 512, 512) != 512 || buf[0] != 'b'){
+    printf(1, "fadvise dontneed failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("fadvise");
+
+  pipe(fds);
+  if(fadvise(fds[0], 0, 0, FADV_SEQUENTIAL) == 0){
+    printf(1, "fadvise on a pipe succeeded\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  printf(1, "fadvise ok\n");
+}
+
+// sendfile into a pipe must not hold the file while the pipe is
+// full: here the reader of the pipe reads the file too.
+void
+sendfiletest(void)
+{
+  int fd, i, n, pid, fds[2];
+
+  printf(1, "sendfile test\n");
+
+  unlink("sendfile");
+  fd = open("sendfile", O_CREATE | O_RDWR);
+  for(i = 0; i < 8; i++){
+    memset(buf, 'a' + i, 512);
+    write(fd, buf, 512);
+  }
+  close(fd);
+
+  pipe(fds);
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("sendfile", 0);
+    if(sendfile(fds[1], fd, -1, 8*512) != 8*512){
+      printf(1, "sendfile to pipe failed\n");
+      exit();
+    }
+    exit();
+  }
+  close(fds[1]);
+  sleep(10);  // let the pipe fill
+  fd = open("sendfile", 0);
+  if(pread(fd, buf, 512, 512) != 512 || buf[0] != 'b'){
+    printf(1, "sendfile: file read failed\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; (n = read(fds[0], buf, sizeof(buf))) > 0; i += n)
+    if(buf[0] != 'a' + i/512){
+      printf(1, "sendfile wrong data\n");
+      exit();
+    }
+  close(fds[0]);
+  wait();
+  if(i != 8*512){
+    printf(1, "sendfile sent %d bytes\n", i);
+    exit();
+  }
+  unlink("sendfile");
+
+  printf(1, "sendfile ok\n");
+}
+
+// reading a file back from the disk shows up in its statistics.
+void
+diskstattest(void)
+{
+  static struct diskstat st0, st;
+  struct stat s;
+  int fd, i;
+
+  printf(1, "diskstat test\n");
+
+  unlink("diskstat");
+  fd = open("diskstat", O_CREATE | O_RDWR);
+  for(i = 0; i < 4; i++)
+    write(fd, buf, 512);
+  fstat(fd, &s);
+  if(diskstat(s.dev, &st0) != 0 || diskstat(-1, &st) == 0){
+    printf(1, "diskstat failed\n");
+    exit();
+  }
+  fadvise(fd, 0, 0, FADV_DONTNEED);
+  pread(fd, buf, 2048, 0);
+  diskstat(s.dev, &st);
+  if(st.nreq[0] == st0.nreq[0] || st.nqueued == st0.nqueued){
+    printf(1, "diskstat counted no reads\n");
+    exit();
+  }
+  close(fd);
+  unlink("diskstat");
+
+  printf(1, "diskstat ok\n");
+}
+
+// processes on all CPUs fork and exec at once, so that
+// pages are allocated and freed on each of them.  The per-CPU
+// page caches should spare most of them the global lock.
+void
+forkexecstress(void)
+{
+  char *args[] = { "echo", 0 };
+  struct kmemstat st0, st;
+  int i, j, pid, t;
+  uint n, nlock;
+
+  printf(1, "fork/exec stress test\n");
+  kmemstat(&st0);
+  t = uptime();
+  for(i = 0; i < 8; i++){
+    if((pid = fork()) < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid > 0)
+      continue;
+    for(j = 0; j < 20; j++){
+      if((pid = fork()) < 0){
+        printf(1, "fork failed\n");
+        exit();
+      }
+      if(pid == 0){
+        close(1);  // quiet echo
+        exec("echo", args);
+        printf(2, "exec echo failed\n");
+        exit();
+      }
+      wait();
+    }
+    exit();
+  }
+  for(i = 0; i < 8; i++)
+    if(wait() < 0){
+      printf(1, "wait failed\n");
+      exit();
+    }
+  t = uptime() - t;
+  kmemstat(&st);
+  n = (st.nalloc - st0.nalloc) + (st.nfree - st0.nfree);
+  nlock = st.nlock - st0.nlock;
+  printf(1, "%d ticks, %d kallocs and kfrees, kmem.lock taken %d times, "
+         "%d of them held by another cpu\n",
+         t, n, nlock, st.ncontended - st0.ncontended);
+  // Without the caches, every page would take the lock.
+  if(n == 0 || nlock * 4 > n){
+    printf(1, "fork/exec stress: kmem.lock taken too often\n");
+    exit();
+  }
+  printf(1, "fork/exec stress ok\n");
+}
+
+// defrag moves a file written in turn with another into one
+// extent, without changing what it holds.
+void
+defragtest(void)
+{
+  int fd, fd2, i;
+
+  printf(1, "defrag test\n");
+
+  unlink("defrag0");
+  unlink("defrag1");
+  fd = open("defrag0", O_CREATE | O_RDWR);
+  fd2 = open("defrag1", O_CREATE | O_RDWR);
+  for(i = 0; i < 24; i++){
+    memset(buf, 'a' + i, 512);
+    write(fd, buf, 512);
+    write(fd2, buf, 512);
+  }
+  close(fd2);
+  unlink("defrag1");
+  if(defrag(fd, 0) < 2){
+    printf(1, "defrag: file not fragmented\n");
+    exit();
+  }
+  fd2 = open("defrag0", O_RDONLY);
+  if(defrag(fd2, 1) >= 0 || defrag(fd2, 0) < 2){
+    printf(1, "defrag moved a read-only file\n");
+    exit();
+  }
+  close(fd2);
+  if(defrag(fd, 1) != 1 || defrag(fd, 0) != 1){
+    printf(1, "defrag failed\n");
+    exit();
+  }
+  for(i = 0; i < 24; i++){
+    if(pread(fd, buf, 512, i*512) != 512 || buf[0] != 'a' + i || buf[511] != 'a' + i){
+      printf(1, "defrag wrong data\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("defrag0");
+
+  printf(1, "defrag ok\n");
+}
+
 // two processes write two different files at the same
 // time, to test block allocation.
 void
@@ -592,6 +890,75 @@ unlinkread(void)
   printf(1, "unlinkread ok\n");
 }
 
+void
+renametest(void)
+{
+  int fd;
+
+  printf(1, "rename test\n");
+
+  unlink("rn1");
+  unlink("rn2");
+  fd = open("rn1", O_CREATE|O_RDWR);
+  write(fd, "one", 3);
+  close(fd);
+  fd = open("rn2", O_CREATE|O_RDWR);
+  write(fd, "two", 3);
+  close(fd);
+
+  // Replace an existing file.
+  if(rename("rn1", "rn2") != 0){
+    printf(1, "rename rn1 rn2 failed\n");
+    exit();
+  }
+  if(open("rn1", 0) >= 0){
+    printf(1, "rn1 still exists\n");
+    exit();
+  }
+  fd = open("rn2", 0);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != 3 || buf[0] != 'o'){
+    printf(1, "rn2 wrong contents\n");
+    exit();
+  }
+  close(fd);
+
+  // Move a file and a directory across directories.
+  if(mkdir("rnd") != 0 || mkdir("rnd/sub") != 0){
+    printf(1, "mkdir rnd failed\n");
+    exit();
+  }
+  if(rename("rn2", "rnd/sub/rn3") != 0 || rename("rnd/sub", "rnsub") != 0){
+    printf(1, "rename across directories failed\n");
+    exit();
+  }
+  if(rename("rnsub", "rnsub/x") == 0){
+    printf(1, "renamed a directory into itself\n");
+    exit();
+  }
+  fd = open("rnsub/../rnsub/rn3", 0);
+  if(fd < 0){
+    printf(1, "open rnsub/rn3 failed\n");
+    exit();
+  }
+  close(fd);
+  if(rename("rnd", "rnsub") == 0){
+    printf(1, "renamed over a non-empty directory\n");
+    exit();
+  }
+  if(mkdir("rnsub/d") != 0 || mkdir("rnsub/d/e") != 0 ||
+     rename("rnsub/d/e", "rnsub") == 0 ||
+     unlink("rnsub/d/e") != 0 || unlink("rnsub/d") != 0){
+    printf(1, "renamed over an ancestor\n");
+    exit();
+  }
+
+  if(unlink("rnsub/rn3") != 0 || unlink("rnsub") != 0 || unlink("rnd") != 0){
+    printf(1, "unlink after rename failed\n");
+    exit();
+  }
+  printf(1, "rename ok\n");
+}
+
 void
 linktest(void)
 {
@@ -1023,6 +1390,284 @@ bigfile(void)
   printf(1, "bigfile test ok\n");
 }
 
+// mmap of a file: read-only view, then a shared writable
+// mapping whose stores must reach the file after munmap.
+void
+mmaptest(void)
+{
+  int fd, i;
+  char *p;
+
+  printf(1, "mmap test\n");
+
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create mmapfile\n");
+    exit();
+  }
+  for(i = 0; i < 6; i++){
+    memset(buf, 'a' + i, 1000);
+    if(write(fd, buf, 1000) != 1000){
+      printf(1, "write mmapfile failed\n");
+      exit();
+    }
+  }
+
+  p = mmap(0, 6000, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf(1, "mmap read-only failed\n");
+    exit();
+  }
+  for(i = 0; i < 6000; i++){
+    if(p[i] != 'a' + i/1000){
+      printf(1, "mmap wrong data at %d\n", i);
+      exit();
+    }
+  }
+  if(munmap(p, 6000) < 0){
+    printf(1, "munmap failed\n");
+    exit();
+  }
+
+  p = mmap(0, 6000, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf(1, "mmap shared failed\n");
+    exit();
+  }
+  p[0] = 'X';
+  p[4500] = 'Y';
+  if(munmap(p, 6000) < 0){
+    printf(1, "munmap shared failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("mmapfile", 0);
+  if(read(fd, buf, 1000) != 1000 || buf[0] != 'X'){
+    printf(1, "mmap store 1 lost\n");
+    exit();
+  }
+  for(i = 1; i < 5; i++)
+    read(fd, buf, 1000);
+  if(buf[500] != 'Y'){
+    printf(1, "mmap store 2 lost\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapfile");
+
+  printf(1, "mmap test ok\n");
+}
+
+// pread/pwrite must not move the file offset;
+// writev/readv move several segments in one call.
+void
+preadtest(void)
+{
+  int fd;
+  struct iovec iov[3];
+  char a[4], b[4], c[4];
+
+  printf(1, "pread test\n");
+
+  unlink("preadfile");
+  fd = open("preadfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create preadfile\n");
+    exit();
+  }
+  iov[0].base = "aaa";
+  iov[0].len = 3;
+  iov[1].base = "bbb";
+  iov[1].len = 3;
+  iov[2].base = "ccc";
+  iov[2].len = 3;
+  if(writev(fd, iov, 3) != 9){
+    printf(1, "writev failed\n");
+    exit();
+  }
+  if(pwrite(fd, "X", 1, 4) != 1 || lseek(fd, 0, SEEK_CUR) != 9){
+    printf(1, "pwrite moved offset\n");
+    exit();
+  }
+  if(pread(fd, a, 3, 3) != 3 || a[0] != 'b' || a[1] != 'X'){
+    printf(1, "pread wrong data\n");
+    exit();
+  }
+  if(lseek(fd, 0, SEEK_SET) != 0){
+    printf(1, "lseek failed\n");
+    exit();
+  }
+  iov[0].base = a;
+  iov[1].base = b;
+  iov[2].base = c;
+  if(readv(fd, iov, 3) != 9 || a[0] != 'a' || b[1] != 'X' || c[2] != 'c'){
+    printf(1, "readv wrong data\n");
+    exit();
+  }
+  close(fd);
+  unlink("preadfile");
+
+  printf(1, "pread test ok\n");
+}
+
+// writes past the end leave holes that read as zeroes.
+void
+sparsetest(void)
+{
+  int fd, i;
+  char buf[512];
+  struct stat st;
+
+  printf(1, "sparse test\n");
+
+  unlink("sparsefile");
+  fd = open("sparsefile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create sparsefile\n");
+    exit();
+  }
+  if(lseek(fd, 40*512 + 7, SEEK_SET) != 40*512 + 7 || write(fd, "end", 3) != 3){
+    printf(1, "write past end failed\n");
+    exit();
+  }
+  if(pwrite(fd, "mid", 3, 20*512) != 3){
+    printf(1, "pwrite into hole failed\n");
+    exit();
+  }
+  if(fstat(fd, &st) < 0 || st.size != 40*512 + 10){
+    printf(1, "sparse size wrong\n");
+    exit();
+  }
+  if(pread(fd, buf, sizeof(buf), 3*512) != sizeof(buf)){
+    printf(1, "read of hole failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != 0){
+      printf(1, "hole not zero\n");
+      exit();
+    }
+  }
+  if(pread(fd, buf, 4, 20*512 - 1) != 4 || buf[0] != 0 || buf[1] != 'm' ||
+     pread(fd, buf, 4, 40*512 + 6) != 4 || buf[0] != 0 || buf[3] != 'd'){
+    printf(1, "sparse data wrong\n");
+    exit();
+  }
+  close(fd);
+  unlink("sparsefile");
+
+  printf(1, "sparse test ok\n");
+}
+
+// a clone shares blocks with its source until
+// one of them writes to them.
+void
+clonetest(void)
+{
+  int fd, cfd, i, n;
+
+  printf(1, "clone test\n");
+
+  unlink("clonesrc");
+  unlink("clonedst");
+  fd = open("clonesrc", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create clonesrc\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    memset(buf, 'a' + i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(1, "write clonesrc failed\n");
+      exit();
+    }
+  }
+  if(clone(fd, "clonedst") != 0 || clone(fd, "clonedst") == 0){
+    printf(1, "clone failed\n");
+    exit();
+  }
+  cfd = open("clonedst", O_RDWR);
+  if(cfd < 0){
+    printf(1, "cannot open clonedst\n");
+    exit();
+  }
+  // Change one byte in a direct and in an indirect block.
+  if(pwrite(cfd, "X", 1, 2*512 + 5) != 1 || pwrite(cfd, "Y", 1, 15*512) != 1){
+    printf(1, "write clonedst failed\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    if(pread(fd, buf, 512, i*512) != 512 || buf[5] != 'a' + i || buf[0] != 'a' + i){
+      printf(1, "clonesrc changed\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("clonesrc");
+  for(i = 0; i < 20; i++){
+    n = pread(cfd, buf, 512, i*512);
+    if(n != 512 || buf[5] != (i == 2 ? 'X' : 'a' + i) ||
+       buf[0] != (i == 15 ? 'Y' : 'a' + i) || buf[511] != 'a' + i){
+      printf(1, "clonedst wrong data\n");
+      exit();
+    }
+  }
+  close(cfd);
+  unlink("clonedst");
+
+  printf(1, "clone test ok\n");
+}
+
+void
+compresstest(void)
+{
+  int fd, i, n;
+
+  printf(1, "compress test\n");
+
+  unlink("compressed");
+  fd = open("compressed", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "cannot create compressed\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    memset(buf, 'a' + i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(1, "write compressed failed\n");
+      exit();
+    }
+  }
+  if((n = compress(fd)) <= 0){
+    printf(1, "compress failed %d\n", n);
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    if(pread(fd, buf, 512, i*512) != 512 || buf[0] != 'a' + i || buf[511] != 'a' + i){
+      printf(1, "compressed wrong data\n");
+      exit();
+    }
+  }
+  // Writing to a compressed cluster stores it uncompressed.
+  if(pwrite(fd, "X", 1, 3*512 + 7) != 1){
+    printf(1, "write compressed failed\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    if(pread(fd, buf, 512, i*512) != 512 || buf[0] != 'a' + i ||
+       buf[7] != (i == 3 ? 'X' : 'a' + i)){
+      printf(1, "compressed wrong data after write\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("compressed");
+
+  printf(1, "compress test ok\n");
+}
+
 void
 fourteen(void)
 {
@@ -1446,9 +2091,20 @@ main(int argc, char *argv[])
   rmdot();
   fourteen();
   bigfile();
+  mmaptest();
+  preadtest();
+  sendfiletest();
+  sparsetest();
+  clonetest();
+  compresstest();
+  defragtest();
+  sharedread();
+  fadvisetest();
+  diskstattest();
   subdir();
   concreate();
   linktest();
+  renametest();
   unlinkread();
   createdelete();
   twofiles();
@@ -1456,6 +2112,7 @@ main(int argc, char *argv[])
   dirfile();
   iref();
   forktest();
+  forkexecstress();
   bigdir(); // slow
 
   exectest();
@@ -0,0 +1,371 @@
+// Virtio block device driver (legacy PCI interface).
+//
+// QEMU's virtio-blk (-drive file=fs.img,if=virtio) appears as
+// PCI device 1af4:1001.  The first NVIO found are disks VIODEV,
+// VIODEV+1, ..., after the IDE disks.
+//
+// Unlike an IDE disk, a virtio disk takes many requests at once.
+// A request is a chain of descriptors in a queue shared with the
+// device: a header saying what to do, the data of one or more
+// bufs, and a status byte for the device to fill in.  The driver
+// posts the chain's first descriptor in the available ring, and
+// the device posts it in the used ring when done, in any order.
+//
+// Up to DISK_DEPTH requests are in flight; more bufs wait in the
+// disk's I/O scheduler queue (iosched.c).  When a request slot
+// frees up, the next buf goes out with the ones after it that
+// hold the following blocks, in one request of up to DISK_MERGE
+// sectors.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "disk.h"
+#include "iosched.h"
+
+#define NVIO          2     // virtio disks
+#define VIODEV        4     // dev of the first one
+
+// Legacy virtio registers, from the I/O base in BAR0.
+#define VIO_FEATURES  0     // features the device has
+#define VIO_GFEATURES 4     // features the driver uses
+#define VIO_QADDR     8     // page number of the selected queue
+#define VIO_QSIZE     12    // entries in the selected queue
+#define VIO_QSEL      14
+#define VIO_QNOTIFY   16
+#define VIO_STATUS    18
+#define VIO_ISR       19    // reading acknowledges the interrupt
+
+// VIO_STATUS bits
+#define VIO_ACK       1
+#define VIO_DRIVER    2
+#define VIO_DRIVER_OK 4
+#define VIO_FAILED    128
+
+#define VQMAX         256   // largest queue the driver handles
+
+struct vdesc {
+  uint addr;
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VD_NEXT       1     // the chain goes on at next
+#define VD_WRITE      2     // the device writes the buffer
+
+struct vavail {
+  ushort flags;
+  ushort idx;               // where the driver posts next
+  ushort ring[VQMAX];
+};
+
+struct vused {
+  ushort flags;
+  volatile ushort idx;      // where the device posts next
+  struct {
+    uint id;                // first descriptor of the chain
+    uint len;
+  } ring[VQMAX];
+};
+
+// Request header
+struct vhdr {
+  uint type;
+  uint ioprio;
+  uint sector;              // in SECTSIZE units, low 32 bits
+  uint sectorhi;
+};
+#define VBLK_IN       0     // read
+#define VBLK_OUT      1     // write
+
+#define NVREQ         8           // requests in flight, at most
+#define VSEGS         (NBUF + 2)  // descriptors per request
+
+// Request slot i owns descriptors i*VSEGS up to (i+1)*VSEGS.
+// b is 0 if the slot is free.
+struct vreq {
+  struct buf *b;            // bufs, linked by qnext
+  struct vhdr hdr;
+  volatile uchar status;
+};
+
+struct vdisk {
+  struct spinlock lock;
+  ushort base;
+  int irq;
+  int qsize;
+  struct vdesc *desc;
+  struct vavail *avail;
+  struct vused *used;
+  ushort usedidx;           // used ring entries handled
+  struct vreq req[NVREQ];
+  int nreq;                 // requests in flight
+  int depth;                // most requests in flight
+  int maxmerge;             // most sectors per request
+  struct ioq ioq;
+
+  // The queue: descriptors, the available ring and,
+  // at the next page boundary, the used ring.
+  char mem[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+};
+
+static struct vdisk vdisks[NVIO];
+static int nvdisk;
+
+static struct vdisk*
+vdisk(uint dev)
+{
+  if(dev < VIODEV || dev >= VIODEV+nvdisk)
+    panic("virtio: no disk");
+  return &vdisks[dev-VIODEV];
+}
+
+// Set up the virtio disk at d.  Returns -1 if it cannot be used.
+static int
+vdiskinit(struct vdisk *v, struct pcidev *d)
+{
+  uint n;
+
+  if(!(d->bar[0] & PCI_BAR_IO))
+    return -1;
+  pciwrite(d, PCI_COMMAND, pciread(d, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MASTER);
+  v->base = d->bar[0] & ~3;
+  v->irq = d->irq;
+  outb(v->base+VIO_STATUS, 0);  // reset
+  outb(v->base+VIO_STATUS, VIO_ACK);
+  outb(v->base+VIO_STATUS, VIO_ACK|VIO_DRIVER);
+  outl(v->base+VIO_GFEATURES, 0);
+
+  outw(v->base+VIO_QSEL, 0);
+  n = inw(v->base+VIO_QSIZE);
+  if(n < NVREQ*VSEGS || n > VQMAX){
+    outb(v->base+VIO_STATUS, VIO_FAILED);
+    return -1;
+  }
+  v->qsize = n;
+  memset(v->mem, 0, sizeof(v->mem));
+  v->desc = (struct vdesc*)v->mem;
+  v->avail = (struct vavail*)(v->mem + n*sizeof(struct vdesc));
+  v->used = (struct vused*)(v->mem + PGROUNDUP(n*sizeof(struct vdesc) + 6 + 2*n));
+  outl(v->base+VIO_QADDR, PADDR(v->mem) >> PGSHIFT);
+
+  initlock(&v->lock, "virtio");
+  ioqinit(&v->ioq, SCHED_DEADLINE);
+  v->depth = NVREQ;
+  v->maxmerge = NBUF * MAXBSIZE/SECTSIZE;
+  outb(v->base+VIO_STATUS, VIO_ACK|VIO_DRIVER|VIO_DRIVER_OK);
+  picenable(v->irq);
+  ioapicenable(v->irq, ncpu - 1);
+  return 0;
+}
+
+void
+virtioinit(void)
+{
+  struct pcidev d;
+  int i, dev;
+
+  for(i = 0; nvdisk < NVIO && pcifind(0x1af4, 0x1001, PCI_ANY, PCI_ANY, i, &d) == 0; i++){
+    if(vdiskinit(&vdisks[nvdisk], &d) < 0)
+      continue;
+    dev = VIODEV + nvdisk++;
+    bdevsw[dev].rw = virtiorw;
+    bdevsw[dev].prefetch = virtioprefetch;
+    bdevsw[dev].ctl = virtioctl;
+    cprintf("virtio: disk %d\n", dev);
+  }
+}
+
+// Fill in descriptor i, which the chain follows with i+1.
+static void
+vdset(struct vdisk *v, int i, void *a, uint len, int flags)
+{
+  v->desc[i].addr = PADDR(a);
+  v->desc[i].addrhi = 0;
+  v->desc[i].len = len;
+  v->desc[i].flags = flags | VD_NEXT;
+  v->desc[i].next = i + 1;
+}
+
+// Start requests for the bufs waiting on v while fewer than
+// v->depth are in flight.  Caller must hold v->lock.
+static void
+vdispatch(struct vdisk *v)
+{
+  struct buf *b;
+  struct vreq *r;
+  int i, n, rw, started;
+
+  started = 0;
+  while(v->nreq < v->depth && ioqnext(&v->ioq) != 0){
+    for(r = v->req; r->b; r++)
+      ;
+    b = ioqtake(&v->ioq, v->maxmerge, &n);
+    rw = (b->flags & B_DIRTY) ? 0 : VD_WRITE;
+    r->b = b;
+    r->hdr.type = rw ? VBLK_IN : VBLK_OUT;
+    r->hdr.ioprio = 0;
+    r->hdr.sector = b->sector * (b->bsize / SECTSIZE);
+    r->hdr.sectorhi = 0;
+    r->status = 0xff;
+
+    i = (r - v->req) * VSEGS;
+    vdset(v, i, &r->hdr, sizeof(r->hdr), 0);
+    for(; b; b = b->qnext)
+      vdset(v, ++i, b->data, b->bsize, rw);
+    vdset(v, ++i, (void*)&r->status, 1, VD_WRITE);
+    v->desc[i].flags = VD_WRITE;  // end of chain
+
+    v->avail->ring[v->avail->idx % v->qsize] = (r - v->req) * VSEGS;
+    __sync_synchronize();  // chain before index
+    v->avail->idx++;
+    v->nreq++;
+    started = 1;
+  }
+  if(started){
+    __sync_synchronize();
+    outw(v->base+VIO_QNOTIFY, 0);
+  }
+}
+
+// Finish the requests the device has posted as done.  The bufs
+// of a failed request are marked B_ERROR, as AHCI does.
+static void
+vintr(struct vdisk *v)
+{
+  struct buf *b, *async;
+  struct vreq *r;
+
+  acquire(&v->lock);
+  inb(v->base+VIO_ISR);
+  async = 0;
+  while(v->usedidx != v->used->idx){
+    __sync_synchronize();
+    r = &v->req[v->used->ring[v->usedidx % v->qsize].id / VSEGS];
+    v->usedidx++;
+    if(r->status != 0)
+      cprintf("virtio: disk %d: request failed\n", r->b->dev);
+    while((b = r->b) != 0){
+      r->b = b->qnext;
+      diskdone(b);
+      if(r->status != 0)
+        b->flags |= B_ERROR;
+      b->flags |= B_VALID;
+      b->flags &= ~B_DIRTY;
+      wakeup(b);
+      if(b->flags & B_ASYNC){
+        b->qnext = async;
+        async = b;
+      }
+    }
+    v->nreq--;
+  }
+  vdispatch(v);
+  release(&v->lock);
+
+  // No process waits for a prefetched buf.
+  while((b = async) != 0){
+    async = b->qnext;
+    brelse(b);
+  }
+}
+
+// Interrupt handler: serve the virtio disks using irq.
+// Returns 0 if there are none.
+int
+virtiointr(int irq)
+{
+  struct vdisk *v;
+  int found;
+
+  found = 0;
+  for(v = vdisks; v < vdisks+nvdisk; v++){
+    if(v->irq == irq){
+      vintr(v);
+      found = 1;
+    }
+  }
+  return found;
+}
+
+// Start reading b for bprefetch and return at once.
+// vintr releases b when the read completes.
+void
+virtioprefetch(struct buf *b)
+{
+  struct vdisk *v;
+
+  if((b->flags & (B_BUSY|B_ASYNC|B_VALID|B_DIRTY)) != (B_BUSY|B_ASYNC))
+    panic("virtioprefetch");
+  v = vdisk(b->dev);
+  acquire(&v->lock);
+  ioqadd(&v->ioq, b);
+  vdispatch(v);
+  release(&v->lock);
+}
+
+// Sync buf with disk, like iderw.
+void
+virtiorw(struct buf *b)
+{
+  struct vdisk *v;
+
+  if(!(b->flags & B_BUSY))
+    panic("virtiorw: buf not busy");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiorw: nothing to do");
+  v = vdisk(b->dev);
+  acquire(&v->lock);
+  ioqadd(&v->ioq, b);
+  vdispatch(v);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &v->lock);
+  release(&v->lock);
+}
+
+// Read, and unless val < 0 change, setting op (DISK_*) of disk dev.
+// Returns the old value, or -1.
+int
+virtioctl(int dev, int op, int val)
+{
+  struct vdisk *v;
+  int old;
+
+  if(dev < VIODEV || dev >= VIODEV+nvdisk)
+    return -1;
+  v = &vdisks[dev-VIODEV];
+  acquire(&v->lock);
+  switch(op){
+  case DISK_DEPTH:
+    old = v->depth;
+    if(val > NVREQ || val == 0)
+      old = -1;
+    else if(val > 0){
+      v->depth = val;
+      vdispatch(v);
+    }
+    break;
+  case DISK_SCHED:
+    old = v->ioq.policy;
+    if(val >= 0 && ioqpolicy(&v->ioq, val) < 0)
+      old = -1;
+    break;
+  case DISK_MERGE:
+    old = v->maxmerge;
+    if(val >= 0)
+      v->maxmerge = val;
+    break;
+  default:
+    old = -1;
+  }
+  release(&v->lock);
+  return old;
+}
@@ -6,8 +6,6 @@
 #include "proc.h"
 #include "elf.h"
 
-#define USERTOP  0xA0000
-
 static pde_t *kpgdir;  // for use in scheduler()
 
 // Set up CPU's kernel segment descriptors.
@@ -291,6 +289,30 @@ freevm(pde_t *pgdir)
   kfree((void *) pgdir);
 }
 
+// Map the existing physical page pa at user address va in pgdir.
+// Used for pages that the process does not own, such as
+// file pages shared through the page cache.
+int
+mapuvmpage(pde_t *pgdir, uint va, uint pa, int perm)
+{
+  return mappages(pgdir, (void *)va, PGSIZE, pa, perm|PTE_U);
+}
+
+// Remove the mapping of user address va from pgdir without
+// freeing the page, and return the old PTE (0 if none).
+uint
+unmapuvmpage(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint old;
+
+  if(!(pte = walkpgdir(pgdir, (void *)va, 0)) || !(*pte & PTE_P))
+    return 0;
+  old = *pte;
+  *pte = 0;
+  return old;
+}
+
 // Given a parent process's page table, create a copy
 // of it for a child.
 pde_t*
@@ -9,6 +9,24 @@ inb(ushort port)
   return data;
 }
 
+static inline ushort
+inw(ushort port)
+{
+  ushort data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -30,6 +48,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -112,6 +136,15 @@ resp(void)
   return val;
 }
 
+// The time stamp counter, which counts cycles.
+static inline uint64
+rdtsc(void)
+{
+  uint64 t;
+  asm volatile("rdtsc" : "=A" (t));
+  return t;
+}
+
 static inline void
 cli(void)
 {